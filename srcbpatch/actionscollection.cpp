@@ -6,6 +6,7 @@
 #include "fileprocessing.h"
 #include "jsonparser.h"
 #include "bpatchfolders.h"
+#include "transducer.h"
 
 
 namespace bpatch
@@ -24,6 +25,10 @@ namespace
     constexpr const size_t levelTextObject = 5;
     constexpr const size_t levelFileObject = 5;
 
+    // gaps between possible beginnings of sources checked for an unchanged region:
+    // dense data is not searched for long
+    constexpr const size_t maxRegionAttempts = 4096;
+
 ///@brief check for "dictionary" or "todo"
 /// with help of this function
 template <const std::string_view& sv1>
@@ -135,11 +140,223 @@ bool IsReplaceObject(TJSONObject* const pJson)
         JsonAtLevel1_3<todoSV, replaceSV>(pJson->parent_->parent_));
 }
 
+
+/// <summary>
+///   bytes which could be present in the data
+/// </summary>
+typedef std::array<bool, 256> Alphabet;
+
+
+/// <summary>
+///   checks if all bytes of the data are in the alphabet
+/// </summary>
+bool InAlphabet(const std::span<const char> data, const Alphabet& alphabet)
+{
+    return std::ranges::all_of(data, [&alphabet](const char c) { return alphabet[static_cast<unsigned char>(c)]; });
+}
+
+
+/// <summary>
+///   adds bytes of the data to the alphabet
+/// </summary>
+void AddToAlphabet(const std::span<const char> data, Alphabet& alphabet)
+{
+    for (const char c : data)
+    {
+        alphabet[static_cast<unsigned char>(c)] = true;
+    }
+}
+
+
+/// <summary>
+///   checks if the data has bytes from the alphabet
+/// </summary>
+bool Intersects(const std::span<const char> data, const Alphabet& alphabet)
+{
+    return std::ranges::any_of(data, [&alphabet](const char c) { return alphabet[static_cast<unsigned char>(c)]; });
+}
+
+
+/// <summary>
+///   removes pairs which never change the data, and stages without pairs.
+///     Merges stages which do not interact into one. Prints what has been done
+/// </summary>
+/// <param name="stages">stages with their indexes in the todo array</param>
+void AnalyseStages(std::vector<std::pair<size_t, StreamReplacerChoice>>& stages)
+{
+    size_t duplicatePairs = 0;
+    size_t unreachablePairs = 0;
+    size_t identityPairs = 0;
+    size_t removedStages = 0;
+    size_t mergedStages = 0;
+
+    Alphabet input; // bytes which could come to the stage
+    input.fill(true);
+    std::vector<std::pair<size_t, StreamReplacerChoice>> analysed;
+    for (auto& [index, choice] : stages)
+    {
+        if (std::ranges::any_of(choice, [](const AbstractLexemesPair& alpair) { return alpair.first->access().empty(); }))
+        {// it is an error reported by the replacer
+            analysed.emplace_back(index, std::move(choice));
+            input.fill(true);
+            continue;
+        }
+
+        // pairs which could match: the first of the same sources, with bytes which could come
+        StreamReplacerChoice reachable;
+        std::set<std::string_view> sources;
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const std::span<const char> src = alpair.first->access();
+            if (!sources.emplace(src.data(), src.size()).second)
+            {
+                ++duplicatePairs;
+                continue;
+            }
+            if (!InAlphabet(src, input))
+            {
+                ++unreachablePairs;
+                continue;
+            }
+            reachable.push_back(alpair);
+        }
+
+        // pair which replaces the source with itself is not needed, if other sources can not overlap it
+        StreamReplacerChoice needed;
+        for (size_t i = 0; i < reachable.size(); ++i)
+        {
+            const std::span<const char> src = reachable[i].first->access();
+            if (std::ranges::equal(src, reachable[i].second->access()))
+            {
+                Alphabet bytes{};
+                AddToAlphabet(src, bytes);
+                if (std::none_of(reachable.begin(), reachable.end(), [&](const AbstractLexemesPair& other)
+                    { return &other != &reachable[i] && Intersects(other.first->access(), bytes); }))
+                {
+                    ++identityPairs;
+                    continue;
+                }
+            }
+            needed.push_back(reachable[i]);
+        }
+
+        if (needed.empty())
+        {
+            ++removedStages;
+            continue;
+        }
+
+        // bytes which could come to the next stage: single byte sources are always replaced
+        Alphabet output = input;
+        for (const AbstractLexemesPair& alpair : needed)
+        {
+            if (const std::span<const char> src = alpair.first->access(); src.size() == 1)
+            {
+                output[static_cast<unsigned char>(src[0])] = false;
+            }
+        }
+        for (const AbstractLexemesPair& alpair : needed)
+        {
+            AddToAlphabet(alpair.second->access(), output);
+        }
+        input = output;
+        analysed.emplace_back(index, std::move(needed));
+    }
+
+    // the next stage is merged into the previous one if its sources can not have bytes of the previous
+    //   sources and targets, and the previous stage does not delete data which could join its sources
+    stages.clear();
+    for (auto& [index, choice] : analysed)
+    {
+        if (!stages.empty())
+        {
+            StreamReplacerChoice& previous = stages.back().second;
+            Alphabet bytes{};
+            bool deletes = false;
+            for (const AbstractLexemesPair& alpair : previous)
+            {
+                AddToAlphabet(alpair.first->access(), bytes);
+                AddToAlphabet(alpair.second->access(), bytes);
+                deletes = deletes || alpair.second->access().empty() || alpair.first->access().empty();
+            }
+            if (!deletes && std::ranges::none_of(choice, [&bytes](const AbstractLexemesPair& alpair)
+                { return alpair.first->access().empty() || Intersects(alpair.first->access(), bytes); }))
+            {
+                for (const AbstractLexemesPair& alpair : choice)
+                {
+                    previous.push_back(alpair);
+                }
+                ++mergedStages;
+                continue;
+            }
+        }
+        stages.emplace_back(index, std::move(choice));
+    }
+
+    if (duplicatePairs + unreachablePairs + identityPairs + removedStages + mergedStages > 0)
+    {
+        std::cout << "Replaces analysis: removed " << duplicatePairs << " duplicate, " << unreachablePairs << " unreachable, "
+            << identityPairs << " identity pairs, and " << removedStages << " replaces without pairs left; "
+            << mergedStages << " replaces merged into previous ones" << std::endl;
+    }
+}
+
+
+/// <summary>
+///   composes consecutive stages into transducers while they have not more states than the limit.
+///     Stages which only translate bytes are not fused without others: translations are composed anyway
+/// </summary>
+/// <param name="stages">stages with their indexes in the todo array</param>
+/// <param name="maxStates">limit of states of a transducer</param>
+/// <param name="fused">transducers at indexes of the first of fused stages</param>
+/// <param name="fusedInner">true for the rest of fused stages</param>
+void FuseStages(std::vector<std::pair<size_t, StreamReplacerChoice>>& stages, const size_t maxStates,
+    std::vector<std::unique_ptr<Transducer>>& fused, std::vector<bool>& fusedInner)
+{
+    // one stage is replaced faster by its own replacer
+    constexpr size_t minStagesToFuse = 2;
+
+    ByteMap byteMap;
+    for (size_t first = 0, end = 0; first < stages.size(); first = end)
+    {
+        end = first + 1;
+        std::unique_ptr<Transducer> transducer = Transducer::FromChoice(stages[first].second, maxStates);
+        if (!transducer)
+        {
+            continue;
+        }
+
+        bool translations = StreamReplacer::ByteMapOf(stages[first].second, byteMap);
+        for (; end < stages.size(); ++end)
+        {
+            const std::unique_ptr<Transducer> next = Transducer::FromChoice(stages[end].second, maxStates);
+            std::unique_ptr<Transducer> composed = next ? Transducer::Compose(*transducer, *next, maxStates) : nullptr;
+            if (!composed)
+            {
+                break;
+            }
+            transducer = std::move(composed);
+            translations = translations && StreamReplacer::ByteMapOf(stages[end].second, byteMap);
+        }
+
+        if (end - first < minStagesToFuse || translations)
+        {
+            end = first + 1; // the next stage could start own fused stages
+            continue;
+        }
+
+        std::cout << "Replaces " << stages[first].first + 1 << '-' << stages[end - 1].first + 1
+            << " of todo are fused into one transducer of " << transducer->StatesCount() << " states" << std::endl;
+        fused[first] = std::move(transducer);
+        std::fill(fusedInner.begin() + first + 1, fusedInner.begin() + end, true);
+    }
+}
+
 }; // nameless namespace
 
 
 //--------------------------------------------------
-ActionsCollection::ActionsCollection(std::vector<char>&& dataSource)
+ActionsCollection::ActionsCollection(std::vector<char>&& dataSource, const size_t maxFusedStates)
     : jsondata_(std::move(dataSource))
 {
     std::string_view srcView(jsondata_.data(), jsondata_.size());
@@ -149,7 +366,7 @@ ActionsCollection::ActionsCollection(std::vector<char>&& dataSource)
     ProcessComposites();
 
     // setup replacers chain
-    CreateChainOfReplacers();
+    CreateChainOfReplacers(maxFusedStates);
 }
 
 
@@ -273,39 +490,126 @@ void ActionsCollection::OnJsonArrayParsed(TJSONObject* const pJson)
 }
 
 
-void ActionsCollection::DoReplacements(const char toProcess, const bool aEod) const
-{
-    // pass the data through inner chain of the replacers
-    replacersChain_->DoReplacements(toProcess, aEod);
-}
-
-
 //--------------------------------------------------
 /// <summary>
-///    stream for bytes to replace
+///    accumulates output of the stage. Too big output is processed by the next stages
+///   as soon as it is accumulated, the rest - after the stage has processed its block
 /// </summary>
-struct StreamReplacerRouter final : public StreamReplacer
+class ActionsCollection::StageArena final : public StreamReplacer
 {
-    std::unique_ptr<StreamReplacer> pToChange_; // to pick address of this pointer
+public:
+    StageArena(const ActionsCollection& owner, const size_t stage)
+        : owner_(owner)
+        , stage_(stage)
+    {}
 
-    virtual void DoReplacements(const char toProcess, const bool aEod) const override
+    void DoReplacements(const std::span<const char> toProcess, const bool) const override
     {
-        pToChange_->DoReplacements(toProcess, aEod);
+        data_.insert(data_.end(), toProcess.begin(), toProcess.end());
+        if (data_.size() >= SZBUFF_FC) [[unlikely]]
+        {
+            owner_.ProcessStages(stage_ + 1, data_, false);
+            data_.clear();
+        }
     }
-    virtual void SetNextReplacer(std::unique_ptr<StreamReplacer>&& pNext) override
+
+    void SetNextReplacer(std::unique_ptr<StreamReplacer>&&) override
     {
-        std::swap(pToChange_, pNext);
+        throw std::logic_error("Stage arena should be unchangeable. Contact with maintainer.");
     }
+
+    std::span<const char> Data() const noexcept
+    {
+        return data_;
+    }
+
+    void Clear() const noexcept
+    {
+        data_.clear();
+    }
+
+protected:
+    const ActionsCollection& owner_;
+    const size_t stage_; // index of the stage which sends its output here
+
+    mutable std::vector<char> data_;
 };
-//
-//--------------------------------------------------
 
 
+void ActionsCollection::DoReplacements(const std::span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == last_)
+    {
+        throw std::logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    ProcessStages(0, toProcess, aEod);
+}
+
+
+void ActionsCollection::ProcessStages(const size_t first, std::span<const char> toProcess, const bool aEod) const
+{
+    for (size_t i = first; i < stages_.size(); ++i)
+    {
+        stages_[i]->DoReplacements(toProcess, aEod);
+        if (i > first)
+        {// the block of the previous stage is processed
+            arenas_[i - 1]->Clear();
+        }
+        toProcess = arenas_[i]->Data();
+    }
+
+    last_->DoReplacements(toProcess, aEod);
+    if (stages_.size() > first)
+    {
+        arenas_.back()->Clear();
+    }
+}
+
 
 void ActionsCollection::SetNextReplacer(std::unique_ptr<StreamReplacer>&& pNext)
 {
-    // inside the last replacer
-    std::swap(*replacersLast_, pNext);
+    // after the last stage
+    std::swap(last_, pNext);
+}
+
+
+std::span<const char> ActionsCollection::UnchangedRegion(const std::span<const char> data, const size_t minSize) const
+{
+    if (nullptr == sourcesStart_ || data.size() < minSize + sourcesStart_->Width())
+    {
+        return std::span<const char>();
+    }
+
+    auto isCut = [this](const char c) noexcept
+    {
+        return cutBytes_[static_cast<unsigned char>(c)];
+    };
+
+    // positions are checked while the filter has all bytes it checks at a position
+    const char* const to = data.data() + data.size() - (sourcesStart_->Width() - 1);
+    const char* from = data.data();
+    for (size_t attempts = 0; attempts < maxRegionAttempts && static_cast<size_t>(to - from) >= minSize; ++attempts)
+    {
+        const char* const candidate = sourcesStart_->Find(from, to);
+        if (static_cast<size_t>(candidate - from) >= minSize)
+        {// no source begins here: the region is from the first to the last bytes out of sources
+            const char* const first = std::find_if(from, candidate, isCut);
+            const char* const last = std::find_if(std::make_reverse_iterator(candidate),
+                std::make_reverse_iterator(first), isCut).base();
+            if (static_cast<size_t>(last - first) >= minSize)
+            {
+                return std::span<const char>(first, last);
+            }
+        }
+
+        if (candidate == to)
+        {
+            break;
+        }
+        from = candidate + 1;
+    }
+    return std::span<const char>();
 }
 
 
@@ -450,21 +754,18 @@ void ActionsCollection::ProcessComposites()
 }
 
 
-void ActionsCollection::CreateChainOfReplacers()
+void ActionsCollection::CreateChainOfReplacers(const size_t maxFusedStates)
 {
     if (replaces_.empty())
     {
         ReportError("Nothing to replace in todo array of Actions file");
     }
 
-    std::unique_ptr<StreamReplacerRouter> lastInstanceOfReplacers(new StreamReplacerRouter);
-    replacersLast_ = &lastInstanceOfReplacers.get()->pToChange_;
-
-    replacersChain_.reset(lastInstanceOfReplacers.release());
-
-    for (auto rit = replaces_.crbegin(); rit != replaces_.crend(); ++rit) // from the end
+    // stages in order of the todo array with their indexes in it
+    std::vector<std::pair<size_t, StreamReplacerChoice>> stages;
+    for (size_t i = 0; i < replaces_.size(); ++i)
     {
-        const VectorStringviewPairs& vPairs = *rit;
+        const VectorStringviewPairs& vPairs = replaces_[i];
 
         if (vPairs.empty())// check for no replace
         {
@@ -491,13 +792,97 @@ void ActionsCollection::CreateChainOfReplacers()
 
             sourceTargetPairs.emplace_back(std::move(alexemesPair));
         }
+        stages.emplace_back(i, std::move(sourceTargetPairs));
+    }
+
+    AnalyseStages(stages);
+
+    // data without beginnings of sources passes through all stages unchanged;
+    // bytes out of sources are borders which no replace could take data across
+    std::vector<std::span<const char>> sources;
+    bool emptySource = false;
+    cutBytes_.fill(true);
+    for (auto& [index, choice] : stages)
+    {
+        for (const AbstractLexemesPair& alpair : choice)
+        {
+            sources.push_back(alpair.first->access());
+            emptySource = emptySource || sources.back().empty();
+            for (const char c : sources.back())
+            {
+                cutBytes_[static_cast<unsigned char>(c)] = false;
+            }
+        }
+    }
+    if (!emptySource && !sources.empty() && std::ranges::find(cutBytes_, true) != cutBytes_.end())
+    {
+        sourcesStart_.reset(new LexemeStartFilter(sources));
+    }
+
+    // consecutive stages composed into transducers: the transducer is at the first of them
+    std::vector<std::unique_ptr<Transducer>> fused(stages.size());
+    std::vector<bool> fusedInner(stages.size()); // the stage is composed into the transducer of previous stage
+    if (maxFusedStates > 0)
+    {
+        FuseStages(stages, maxFusedStates, fused, fusedInner);
+    }
+
+    // replacers are created from the end
+    auto addToChain = [this](std::unique_ptr<StreamReplacer>&& replacer)
+    {
+        stages_.push_back(std::move(replacer));
+    };
+
+    // consecutive translations of bytes are composed into one translation
+    ByteMap byteMap;
+    bool byteMapPending = false;
+
+    for (size_t i = stages.size(); i-- > 0;) // from the end
+    {
+        if (fusedInner[i])
+        {// the transducer of the first of fused stages replaces all of them
+            continue;
+        }
+
+        StreamReplacerChoice& sourceTargetPairs = stages[i].second;
+        if (ByteMap stageMap; !fused[i] && StreamReplacer::ByteMapOf(sourceTargetPairs, stageMap))
+        {
+            if (byteMapPending) // translations after this one are applied to its result
+            {
+                for (unsigned char& c : stageMap)
+                {
+                    c = byteMap[c];
+                }
+            }
+            byteMap = stageMap;
+            byteMapPending = true;
+            continue;
+        }
+
+        if (byteMapPending)
+        {
+            addToChain(StreamReplacer::CreateByteMapReplacer(byteMap));
+            byteMapPending = false;
+        }
+
         // create replacer
-        std::unique_ptr<StreamReplacer> replacer = StreamReplacer::CreateReplacer(sourceTargetPairs);
-        // `replacer` needs to hold tail of the chain
-        // replacersChain_ contains the tail of chain
-        replacer->SetNextReplacer(std::move(replacersChain_)); // now full chain is in replacer
-        replacersChain_ = std::move(replacer); // now full chain is in place
-    } // for(auto rit = replaces_.rbegin(); rit != replaces_.rend(); ++rit)
+        addToChain(fused[i] ? StreamReplacer::CreateTransducerReplacer(std::move(fused[i])) :
+            StreamReplacer::CreateReplacer(sourceTargetPairs));
+    } // for (size_t i = stages.size(); i-- > 0;)
+
+    if (byteMapPending)
+    {
+        addToChain(StreamReplacer::CreateByteMapReplacer(byteMap));
+    }
+
+    // each stage sends its output into its arena
+    std::reverse(stages_.begin(), stages_.end());
+    for (size_t i = 0; i < stages_.size(); ++i)
+    {
+        std::unique_ptr<StageArena> arena(new StageArena(*this, i));
+        arenas_.push_back(arena.get());
+        stages_[i]->SetNextReplacer(std::move(arena));
+    }
 
     // everything has been created. free some memory
     replaces_.clear();
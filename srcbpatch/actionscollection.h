@@ -1,10 +1,12 @@
 #pragma once
 // #include "actionscollection.h"
+#include <array>
 #include <list>
 #include <memory>
 #include <string_view>
 #include <vector>
 
+#include "candidatesearch.h"
 #include "dictionary.h"
 #include "jsonparser.h"
 
@@ -18,14 +20,18 @@ namespace bpatch
 class ActionsCollection final: public TJsonCallBack, public StreamReplacer
 {
 public:
+    // reasonable limit for composing of 'replace' objects:
+    //   transitions of the transducer for this amount of states fit in few megabytes
+    static constexpr std::size_t suggestedMaxFusedStates = 1024;
+
     /// <summary>
     ///   constructor accepts vector with json data and process it
     /// </summary>
     /// <param name="dataSource">json data - vecor data will be held inside and modified
     ///   for inner simplicity of usage</param>
-    /// <param name="pLast">StreamReplacer to pass result of actions 
-    ///   in the end of processing</param>
-    ActionsCollection(std::vector<char>&& dataSource);
+    /// <param name="maxFusedStates">limit of states of the transducer for consecutive
+    ///   'replace' objects composed together; 0 to apply them one by one</param>
+    ActionsCollection(std::vector<char>&& dataSource, const std::size_t maxFusedStates = 0);
 
     /// <summary>
     ///  callback from TJsonCallBack
@@ -54,9 +60,10 @@ public:
     /// <summary>
     ///   callback from StreamReplacer
     /// </summary>
-    /// <param name="toProcess">this char is under processing right now</param>
+    /// <param name="toProcess">this block of data is under processing right now</param>
     /// <param name="aEod">this is sign that no more data</param>
-    void DoReplacements(const char toProcess, const bool aEod) const override;
+    void DoReplacements(const std::span<const char> toProcess, const bool aEod) const override;
+    using StreamReplacer::DoReplacements; // byte by byte processing is here
 
     /// <summary>
     ///   Set next replacer in chain of replacers
@@ -64,6 +71,17 @@ public:
     /// <param name="pNext">replacer to call next</param>
     virtual void SetNextReplacer(std::unique_ptr<StreamReplacer>&& pNext) override;
 
+    /// <summary>
+    ///   finds the region of the data which passes through all replaces unchanged.
+    ///     The region begins and ends with bytes out of all sources: no replace takes data
+    ///     on both sides of its borders. So the data before the region could be processed
+    ///     as the end of data, and the data after the region as new data
+    /// </summary>
+    /// <param name="data">block of data to search in</param>
+    /// <param name="minSize">minimum size of the region</param>
+    /// <returns>the first region in the data; empty if there is no such region</returns>
+    std::span<const char> UnchangedRegion(const std::span<const char> data, const std::size_t minSize) const;
+
 protected:
     /// <summary>
     ///   throws error if we meet error in the expected logic
@@ -111,7 +129,17 @@ protected:
     ///    we are creating and making chain of replacers
     ///   last operation in initialization - dictionary is 100% ready
     /// </summary>
-    void CreateChainOfReplacers();
+    /// <param name="maxFusedStates">limit of states of the transducer for composed 'replace' objects</param>
+    void CreateChainOfReplacers(const std::size_t maxFusedStates);
+
+    /// <summary>
+    ///    passes the block of data through the stages from the first one:
+    ///   each stage processes the whole block into its arena, which is the block for the next stage
+    /// </summary>
+    /// <param name="first">index of the stage to begin from</param>
+    /// <param name="toProcess">block of data for the first stage</param>
+    /// <param name="aEod">this is sign that no more data after the block</param>
+    void ProcessStages(const std::size_t first, std::span<const char> toProcess, const bool aEod) const;
 
 protected:
     // this is data for json parsing
@@ -132,14 +160,33 @@ protected:
     typedef std::vector<StringviewPair> VectorStringviewPairs; // all pairs from one replace
 
     /// <summary>
-    ///  here we are holding chain of the replacers
+    ///   output of a stage to be processed by the next one
     /// </summary>
-    std::unique_ptr<StreamReplacer> replacersChain_;
+    class StageArena;
 
     /// <summary>
-    ///   holds specific StreamReplacer which allows to change last Replacer in chain
+    ///  replacers in order of processing; each of them holds its arena as the next replacer
     /// </summary>
-    std::unique_ptr<StreamReplacer>* replacersLast_ = nullptr;
+    std::vector<std::unique_ptr<StreamReplacer>> stages_;
+
+    /// <summary>
+    ///  arenas of stages_ with the same indexes
+    /// </summary>
+    std::vector<StageArena*> arenas_;
+
+    /// <summary>
+    ///   receives output of the last stage; it is changed by SetNextReplacer
+    /// </summary>
+    std::unique_ptr<StreamReplacer> last_;
+
+    /// <summary>
+    ///   searches where sources of all stages could begin; nullptr if some source is empty
+    ///   or there is no byte out of sources
+    /// </summary>
+    std::unique_ptr<LexemeStartFilter> sourcesStart_;
+
+    // bytes which are not in sources of any stage
+    std::array<bool, 256> cutBytes_{};
 
 private:
     // all replaces, will be cleared after initialization; need temporary object for loading/initialization only
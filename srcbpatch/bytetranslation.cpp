@@ -0,0 +1,345 @@
+#include "stdafx.h"
+#include "bytetranslation.h"
+#include "simdsupport.h"
+
+#include <bit>
+#include <cstdint>
+
+namespace
+{
+using namespace std;
+
+/// <summary>
+///   byte by byte translation. Works for the tails of the SIMD translation
+/// </summary>
+void TranslateBytesScalar(const char* from, const char* const to, char* out, const bpatch::ByteMap& byteMap)
+{
+    for (; from < to; ++from, ++out)
+    {
+        *out = static_cast<char>(byteMap[static_cast<unsigned char>(*from)]);
+    }
+}
+
+
+/// <summary>
+///   byte by byte compaction. Works for the tails of the SIMD compaction
+/// </summary>
+char* CompactScalar(const bpatch::ByteCompactor::Tables& tables, const char* from, const char* const to, char* out)
+{
+    for (; from < to; ++from)
+    {
+        const unsigned char c = static_cast<unsigned char>(*from);
+        *out = static_cast<char>(tables.byteMap_[c]);
+        out += tables.keep_[c];
+    }
+    return out;
+}
+
+
+/// <summary>
+///   shuffles which pack kept bytes of 8 bytes together: for each mask of kept bytes
+///     indexes of kept bytes are the first ones
+/// </summary>
+struct PackShuffles
+{
+    PackShuffles()
+    {
+        for (unsigned mask = 0; mask < 256; ++mask)
+        {
+            uint64_t indexes = 0;
+            unsigned position = 0;
+            for (unsigned i = 0; i < 8; ++i)
+            {
+                if (mask & (1u << i))
+                {
+                    indexes |= uint64_t(i) << (8 * position++);
+                }
+            }
+            memcpy(shuffles_[mask], &indexes, sizeof(indexes));
+        }
+    }
+
+    alignas(8) unsigned char shuffles_[256][8];
+};
+
+const PackShuffles packShuffles;
+
+
+#ifdef BPATCH_SIMD_X64
+/// <summary>
+///   translates 16 bytes through 16 tables, one for each high nibble
+/// </summary>
+BPATCH_TARGET_SSSE3 inline __m128i Translate16(const __m128i (&tables)[16], const __m128i data)
+{
+    const __m128i lowNibble = _mm_set1_epi8(0x0f);
+    const __m128i low = _mm_and_si128(data, lowNibble);
+    const __m128i high = _mm_and_si128(_mm_srli_epi16(data, 4), lowNibble);
+
+    __m128i result = _mm_setzero_si128();
+    for (int i = 0; i < 16; ++i)
+    {
+        const __m128i fromTable = _mm_cmpeq_epi8(high, _mm_set1_epi8(static_cast<char>(i)));
+        result = _mm_or_si128(result, _mm_and_si128(fromTable, _mm_shuffle_epi8(tables[i], low)));
+    }
+    return result;
+}
+
+
+BPATCH_TARGET_AVX2 inline __m256i Translate32(const __m256i (&tables)[16], const __m256i data)
+{
+    const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+    const __m256i low = _mm256_and_si256(data, lowNibble);
+    const __m256i high = _mm256_and_si256(_mm256_srli_epi16(data, 4), lowNibble);
+
+    __m256i result = _mm256_setzero_si256();
+    for (int i = 0; i < 16; ++i)
+    {
+        const __m256i fromTable = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(static_cast<char>(i)));
+        result = _mm256_or_si256(result, _mm256_and_si256(fromTable, _mm256_shuffle_epi8(tables[i], low)));
+    }
+    return result;
+}
+
+
+BPATCH_TARGET_SSSE3 void LoadTables(const bpatch::ByteMap& byteMap, __m128i (&tables)[16])
+{
+    for (size_t i = 0; i < 16; ++i)
+    {
+        tables[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(byteMap.data() + i * 16));
+    }
+}
+
+
+BPATCH_TARGET_AVX2 void LoadTables(const bpatch::ByteMap& byteMap, __m256i (&tables)[16])
+{
+    for (size_t i = 0; i < 16; ++i)
+    {
+        tables[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(byteMap.data() + i * 16)));
+    }
+}
+
+
+BPATCH_TARGET_SSSE3 void TranslateBytesSSSE3(const char* from, const char* const to, char* out, const bpatch::ByteMap& byteMap)
+{
+    __m128i tables[16];
+    LoadTables(byteMap, tables);
+    for (; from + sizeof(__m128i) <= to; from += sizeof(__m128i), out += sizeof(__m128i))
+    {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), Translate16(tables, data));
+    }
+    TranslateBytesScalar(from, to, out, byteMap);
+}
+
+
+BPATCH_TARGET_AVX2 void TranslateBytesAVX2(const char* from, const char* const to, char* out, const bpatch::ByteMap& byteMap)
+{
+    __m256i tables[16];
+    LoadTables(byteMap, tables);
+    for (; from + sizeof(__m256i) <= to; from += sizeof(__m256i), out += sizeof(__m256i))
+    {
+        const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), Translate32(tables, data));
+    }
+    TranslateBytesScalar(from, to, out, byteMap);
+}
+
+
+/// <summary>
+///   writes kept bytes of 8 bytes in the lower half of the data one by one
+/// </summary>
+/// <param name="data">the data; its lower half is packed</param>
+/// <param name="keep">bits of kept bytes</param>
+/// <param name="out">output for kept bytes; 8 bytes are written</param>
+/// <returns>the end of kept bytes in the output</returns>
+BPATCH_TARGET_SSSE3 inline char* Pack8(const __m128i data, const unsigned keep, char* const out)
+{
+    const __m128i shuffle = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(packShuffles.shuffles_[keep]));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(data, shuffle));
+    return out + popcount(keep);
+}
+
+
+/// <summary>
+///   writes kept bytes of 16 bytes one by one
+/// </summary>
+BPATCH_TARGET_SSSE3 inline char* Pack16(const __m128i data, const unsigned keep, char* out)
+{
+    out = Pack8(data, keep & 0xff, out);
+    return Pack8(_mm_srli_si128(data, 8), keep >> 8, out);
+}
+
+
+/// <summary>
+///   finds deleted bytes: their bits of high nibbles are set in the masks by low nibble
+/// </summary>
+BPATCH_TARGET_SSSE3 inline __m128i Deleted16(const bpatch::ByteCompactor::Tables& tables, const __m128i data)
+{
+    const __m128i lowNibble = _mm_set1_epi8(0x0f);
+    const __m128i bitOfHigh = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i low = _mm_and_si128(data, lowNibble);
+    const __m128i high = _mm_and_si128(_mm_srli_epi16(data, 4), lowNibble);
+
+    const __m128i upper = _mm_cmpgt_epi8(high, _mm_set1_epi8(7));
+    const __m128i bits = _mm_or_si128(
+        _mm_andnot_si128(upper, _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.deletedLow_)), low)),
+        _mm_and_si128(upper, _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.deletedHigh_)), low)));
+    const __m128i bit = _mm_shuffle_epi8(bitOfHigh, high);
+    return _mm_cmpeq_epi8(_mm_and_si128(bits, bit), bit);
+}
+
+
+BPATCH_TARGET_AVX2 inline __m256i Deleted32(const bpatch::ByteCompactor::Tables& tables, const __m256i data)
+{
+    const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+    const __m256i bitOfHigh = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i low = _mm256_and_si256(data, lowNibble);
+    const __m256i high = _mm256_and_si256(_mm256_srli_epi16(data, 4), lowNibble);
+
+    const __m256i deletedLow = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.deletedLow_)));
+    const __m256i deletedHigh = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.deletedHigh_)));
+    const __m256i bits = _mm256_blendv_epi8(_mm256_shuffle_epi8(deletedLow, low), _mm256_shuffle_epi8(deletedHigh, low),
+        _mm256_cmpgt_epi8(high, _mm256_set1_epi8(7)));
+    const __m256i bit = _mm256_shuffle_epi8(bitOfHigh, high);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bits, bit), bit);
+}
+
+
+BPATCH_TARGET_SSSE3 char* CompactSSSE3(const bpatch::ByteCompactor::Tables& tables, const char* from, const char* const to, char* out)
+{
+    __m128i translation[16];
+    LoadTables(tables.byteMap_, translation);
+    for (; from + sizeof(__m128i) <= to; from += sizeof(__m128i))
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from));
+        const unsigned keep = ~static_cast<unsigned>(_mm_movemask_epi8(Deleted16(tables, data))) & 0xffff;
+        if (0 == keep)
+        {
+            continue;
+        }
+        if (tables.translate_)
+        {
+            data = Translate16(translation, data);
+        }
+        if (0xffff == keep)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), data);
+            out += sizeof(__m128i);
+            continue;
+        }
+        out = Pack16(data, keep, out);
+    }
+    return CompactScalar(tables, from, to, out);
+}
+
+
+BPATCH_TARGET_AVX2 char* CompactAVX2(const bpatch::ByteCompactor::Tables& tables, const char* from, const char* const to, char* out)
+{
+    __m256i translation[16];
+    LoadTables(tables.byteMap_, translation);
+    for (; from + sizeof(__m256i) <= to; from += sizeof(__m256i))
+    {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from));
+        const uint32_t keep = ~static_cast<uint32_t>(_mm256_movemask_epi8(Deleted32(tables, data)));
+        if (0 == keep)
+        {
+            continue;
+        }
+        if (tables.translate_)
+        {
+            data = Translate32(translation, data);
+        }
+        if (~uint32_t(0) == keep)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), data);
+            out += sizeof(__m256i);
+            continue;
+        }
+        out = Pack16(_mm256_castsi256_si128(data), keep & 0xffff, out);
+        out = Pack16(_mm256_extracti128_si256(data, 1), keep >> 16, out);
+    }
+    return CompactScalar(tables, from, to, out);
+}
+#endif // BPATCH_SIMD_X64
+
+
+typedef void (*TranslateBytesFunction)(const char*, const char* const, char*, const bpatch::ByteMap&);
+
+/// <summary>
+///   selects the fastest translation for the processor we are running on
+/// </summary>
+TranslateBytesFunction SelectTranslateBytes()
+{
+#ifdef BPATCH_SIMD_X64
+    if (bpatch::AVX2Supported())
+    {
+        return TranslateBytesAVX2;
+    }
+    return bpatch::SSSE3Supported() ? TranslateBytesSSSE3 : TranslateBytesScalar;
+#else
+    return TranslateBytesScalar;
+#endif
+}
+
+
+typedef char* (*CompactFunction)(const bpatch::ByteCompactor::Tables&, const char*, const char* const, char*);
+
+/// <summary>
+///   selects the fastest compaction for the processor we are running on
+/// </summary>
+CompactFunction SelectCompact()
+{
+#ifdef BPATCH_SIMD_X64
+    if (bpatch::AVX2Supported())
+    {
+        return CompactAVX2;
+    }
+    return bpatch::SSSE3Supported() ? CompactSSSE3 : CompactScalar;
+#else
+    return CompactScalar;
+#endif
+}
+
+};
+
+
+namespace bpatch
+{
+using namespace std;
+
+void TranslateBytes(const char* from, const char* const to, char* out, const ByteMap& byteMap)
+{
+    static const TranslateBytesFunction translateBytes = SelectTranslateBytes();
+    translateBytes(from, to, out, byteMap);
+}
+
+
+ByteCompactor::ByteCompactor(const ByteMap& byteMap, const array<bool, 256>& deleted)
+{
+    tables_.byteMap_ = byteMap;
+    memset(tables_.deletedLow_, 0, sizeof(tables_.deletedLow_));
+    memset(tables_.deletedHigh_, 0, sizeof(tables_.deletedHigh_));
+    for (size_t c = 0; c < 256; ++c)
+    {
+        tables_.keep_[c] = deleted[c] ? 0 : 1;
+        if (deleted[c])
+        {
+            unsigned char* const masks = (c < 128) ? tables_.deletedLow_ : tables_.deletedHigh_;
+            masks[c & 0x0f] |= static_cast<unsigned char>(1u << ((c >> 4) & 7));
+        }
+        else if (byteMap[c] != c)
+        {
+            tables_.translate_ = true;
+        }
+    }
+}
+
+
+char* ByteCompactor::Compact(const char* from, const char* const to, char* out) const
+{
+    static const CompactFunction compact = SelectCompact();
+    return compact(tables_, from, to, out);
+}
+
+};// namespace bpatch
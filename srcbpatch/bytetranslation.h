@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <cstddef>
+
+namespace bpatch
+{
+/// <summary>
+///   each byte is translated to the byte at its index
+/// </summary>
+typedef std::array<unsigned char, 256> ByteMap;
+
+/// <summary>
+///   translates bytes through the map.
+///     SSSE3/AVX2 is used where the processor supports it: the map is split into 16 tables
+///     by high nibble of the byte, and each table is looked up by low nibble for 16/32 bytes at once
+/// </summary>
+/// <param name="from">the beginning of the data to translate</param>
+/// <param name="to">the end of the data to translate</param>
+/// <param name="out">translated data; could be the same as 'from'</param>
+/// <param name="byteMap">the map for the translation</param>
+void TranslateBytes(const char* from, const char* const to, char* out, const ByteMap& byteMap);
+
+
+/// <summary>
+///   translates bytes through the map and deletes some of them.
+///     Deleted bytes are found by masks of their low and high nibbles, kept bytes of each
+///     8 bytes are packed together by one shuffle from the table of all masks of kept bytes.
+///     SSSE3/AVX2 is used where the processor supports it, 16/32 bytes are processed at once
+/// </summary>
+class ByteCompactor final
+{
+public:
+    // output is written up to this amount of bytes after the end of compacted data
+    static constexpr std::size_t outputReserve = 32;
+
+    /// <summary>
+    ///   tables for the translation and the search of deleted bytes
+    /// </summary>
+    struct Tables
+    {
+        ByteMap byteMap_; // translation of kept bytes
+        unsigned char keep_[256]; // 1 for kept byte, 0 for deleted one
+        alignas(16) unsigned char deletedLow_[16]; // by low nibble: bits of high nibbles 0-7 of deleted bytes
+        alignas(16) unsigned char deletedHigh_[16]; // by low nibble: bits of high nibbles 8-15 of deleted bytes
+        bool translate_ = false; // kept bytes are changed by the translation
+    };
+
+public:
+    /// <summary>
+    ///   builds tables for the translation and deletion
+    /// </summary>
+    /// <param name="byteMap">translation of kept bytes</param>
+    /// <param name="deleted">true for bytes to delete</param>
+    ByteCompactor(const ByteMap& byteMap, const std::array<bool, 256>& deleted);
+
+    /// <summary>
+    ///   translates kept bytes and writes them one by one
+    /// </summary>
+    /// <param name="from">the beginning of the data</param>
+    /// <param name="to">the end of the data</param>
+    /// <param name="out">output for compacted data; outputReserve bytes after the data must be accessible</param>
+    /// <returns>the end of compacted data in the output</returns>
+    char* Compact(const char* from, const char* const to, char* out) const;
+
+protected:
+    Tables tables_;
+};
+
+};// namespace bpatch
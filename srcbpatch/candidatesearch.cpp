@@ -0,0 +1,273 @@
+#include "stdafx.h"
+#include "candidatesearch.h"
+#include "simdsupport.h"
+
+#include <bit>
+#include <cstdint>
+
+namespace
+{
+using namespace std;
+
+/// <summary>
+///   byte by byte search of the candidate. Works for the tails of the SIMD search
+/// </summary>
+const char* FindCandidateScalar(const char* from, const char* const to,
+    const char first, const char last, const size_t distance)
+{
+    while (from < to)
+    {
+        from = static_cast<const char*>(memchr(from, first, static_cast<size_t>(to - from)));
+        if (nullptr == from)
+        {
+            return to;
+        }
+        if (from[distance] == last)
+        {
+            return from;
+        }
+        ++from;
+    }
+    return to;
+}
+
+/// <summary>
+///   byte by byte search of the lexeme start. Works for the tails of the SIMD search
+/// </summary>
+const char* FindStartScalar(const bpatch::LexemeStartFilter::Masks& masks, const char* from, const char* const to)
+{
+    for (; from < to; ++from)
+    {
+        unsigned char groups = masks.bytes_[0][static_cast<unsigned char>(from[0])];
+        for (size_t i = 1; i < masks.width_ && 0 != groups; ++i)
+        {
+            groups &= masks.bytes_[i][static_cast<unsigned char>(from[i])];
+        }
+        if (0 != groups)
+        {
+            return from;
+        }
+    }
+    return to;
+}
+
+#ifdef BPATCH_SIMD_X64
+const char* FindCandidateSSE2(const char* from, const char* const to,
+    const char first, const char last, const size_t distance)
+{
+    const __m128i firsts = _mm_set1_epi8(first);
+    const __m128i lasts = _mm_set1_epi8(last);
+    for (; from + sizeof(__m128i) <= to; from += sizeof(__m128i))
+    {
+        const __m128i atFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from));
+        const __m128i atLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + distance));
+        const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(atFirst, firsts), _mm_cmpeq_epi8(atLast, lasts))));
+        if (0 != mask)
+        {
+            return from + countr_zero(mask);
+        }
+    }
+    return FindCandidateScalar(from, to, first, last, distance);
+}
+
+
+BPATCH_TARGET_AVX2 const char* FindCandidateAVX2(const char* from, const char* const to,
+    const char first, const char last, const size_t distance)
+{
+    const __m256i firsts = _mm256_set1_epi8(first);
+    const __m256i lasts = _mm256_set1_epi8(last);
+    for (; from + sizeof(__m256i) <= to; from += sizeof(__m256i))
+    {
+        const __m256i atFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from));
+        const __m256i atLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + distance));
+        const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(atFirst, firsts), _mm256_cmpeq_epi8(atLast, lasts))));
+        if (0 != mask)
+        {
+            return from + countr_zero(mask);
+        }
+    }
+    return FindCandidateSSE2(from, to, first, last, distance);
+}
+
+
+BPATCH_TARGET_SSSE3 const char* FindStartSSSE3(const bpatch::LexemeStartFilter::Masks& masks,
+    const char* from, const char* const to)
+{
+    const __m128i lowNibble = _mm_set1_epi8(0x0f);
+    __m128i low[bpatch::LexemeStartFilter::maxWidth];
+    __m128i high[bpatch::LexemeStartFilter::maxWidth];
+    for (size_t i = 0; i < masks.width_; ++i)
+    {
+        low[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(masks.low_[i]));
+        high[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(masks.high_[i]));
+    }
+
+    for (; from + sizeof(__m128i) <= to; from += sizeof(__m128i))
+    {
+        __m128i groups = _mm_set1_epi8(-1);
+        for (size_t i = 0; i < masks.width_; ++i)
+        {
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+            const __m128i byLow = _mm_shuffle_epi8(low[i], _mm_and_si128(data, lowNibble));
+            const __m128i byHigh = _mm_shuffle_epi8(high[i], _mm_and_si128(_mm_srli_epi16(data, 4), lowNibble));
+            groups = _mm_and_si128(groups, _mm_and_si128(byLow, byHigh));
+        }
+        const unsigned int mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(groups, _mm_setzero_si128()))) ^ 0xffffu;
+        if (0 != mask)
+        {
+            return from + countr_zero(mask);
+        }
+    }
+    return FindStartScalar(masks, from, to);
+}
+
+
+BPATCH_TARGET_AVX2 const char* FindStartAVX2(const bpatch::LexemeStartFilter::Masks& masks,
+    const char* from, const char* const to)
+{
+    const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+    __m256i low[bpatch::LexemeStartFilter::maxWidth];
+    __m256i high[bpatch::LexemeStartFilter::maxWidth];
+    for (size_t i = 0; i < masks.width_; ++i)
+    {
+        low[i] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(masks.low_[i])));
+        high[i] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(masks.high_[i])));
+    }
+
+    for (; from + sizeof(__m256i) <= to; from += sizeof(__m256i))
+    {
+        __m256i groups = _mm256_set1_epi8(-1);
+        for (size_t i = 0; i < masks.width_; ++i)
+        {
+            const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i));
+            const __m256i byLow = _mm256_shuffle_epi8(low[i], _mm256_and_si256(data, lowNibble));
+            const __m256i byHigh = _mm256_shuffle_epi8(high[i], _mm256_and_si256(_mm256_srli_epi16(data, 4), lowNibble));
+            groups = _mm256_and_si256(groups, _mm256_and_si256(byLow, byHigh));
+        }
+        const unsigned int mask = ~static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(groups, _mm256_setzero_si256())));
+        if (0 != mask)
+        {
+            return from + countr_zero(mask);
+        }
+    }
+    return FindStartSSSE3(masks, from, to);
+}
+#endif // BPATCH_SIMD_X64
+
+
+typedef const char* (*FindCandidateFunction)(const char*, const char* const, const char, const char, const size_t);
+
+/// <summary>
+///   selects the fastest search for the processor we are running on
+/// </summary>
+FindCandidateFunction SelectFindCandidate()
+{
+#ifdef BPATCH_SIMD_X64
+    return bpatch::AVX2Supported() ? FindCandidateAVX2 : FindCandidateSSE2;
+#else
+    return FindCandidateScalar;
+#endif
+}
+
+
+typedef const char* (*FindStartFunction)(const bpatch::LexemeStartFilter::Masks&, const char*, const char* const);
+
+/// <summary>
+///   selects the fastest search of lexeme starts for the processor we are running on
+/// </summary>
+FindStartFunction SelectFindStart()
+{
+#ifdef BPATCH_SIMD_X64
+    if (bpatch::AVX2Supported())
+    {
+        return FindStartAVX2;
+    }
+    return bpatch::SSSE3Supported() ? FindStartSSSE3 : FindStartScalar;
+#else
+    return FindStartScalar;
+#endif
+}
+
+};
+
+
+namespace bpatch
+{
+using namespace std;
+
+const char* FindCandidate(const char* from, const char* const to,
+    const char first, const char last, const size_t distance)
+{
+    static const FindCandidateFunction findCandidate = SelectFindCandidate();
+    return findCandidate(from, to, first, last, distance);
+}
+
+
+size_t MatchLength(const char* const left, const char* const right, const size_t maxLength)
+{
+    size_t matched = 0;
+    for (; matched + sizeof(uint64_t) <= maxLength; matched += sizeof(uint64_t))
+    {
+        uint64_t l, r;
+        memcpy(&l, left + matched, sizeof(l));
+        memcpy(&r, right + matched, sizeof(r));
+        if (const uint64_t diff = l ^ r; diff != 0)
+        {
+            // the first different byte in memory is the lowest or the highest one
+            return matched + static_cast<size_t>(((endian::native == endian::little) ?
+                countr_zero(diff) : countl_zero(diff)) / 8);
+        }
+    }
+    while (matched < maxLength && left[matched] == right[matched])
+    {
+        ++matched;
+    }
+    return matched;
+}
+
+
+LexemeStartFilter::LexemeStartFilter(const vector<span<const char>>& lexemes)
+{
+    for (const auto& lexeme : lexemes)
+    {
+        masks_.width_ = min(masks_.width_, lexeme.size());
+    }
+
+    // lexemes with the same first byte share a group
+    int groupOfFirstByte[256];
+    fill(begin(groupOfFirstByte), end(groupOfFirstByte), -1);
+    size_t nextGroup = 0;
+
+    memset(masks_.low_, 0, sizeof(masks_.low_));
+    memset(masks_.high_, 0, sizeof(masks_.high_));
+    memset(masks_.bytes_, 0, sizeof(masks_.bytes_));
+    for (const auto& lexeme : lexemes)
+    {
+        int& group = groupOfFirstByte[static_cast<unsigned char>(lexeme[0])];
+        if (group < 0)
+        {
+            group = static_cast<int>(nextGroup++ % groups);
+        }
+        const unsigned char groupBit = static_cast<unsigned char>(1u << group);
+        for (size_t i = 0; i < masks_.width_; ++i)
+        {
+            const unsigned char c = static_cast<unsigned char>(lexeme[i]);
+            masks_.low_[i][c & 0x0f] |= groupBit;
+            masks_.high_[i][c >> 4] |= groupBit;
+            masks_.bytes_[i][c] |= groupBit;
+        }
+    }
+}
+
+
+const char* LexemeStartFilter::Find(const char* from, const char* const to) const
+{
+    static const FindStartFunction findStart = SelectFindStart();
+    return findStart(masks_, from, to);
+}
+
+};// namespace bpatch
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace bpatch
+{
+/// <summary>
+///   searches for the beginning of a lexeme candidate: the position where the first byte
+///     of the lexeme is placed and the last byte of the lexeme is placed 'distance' bytes after.
+///     SSE2/AVX2 is used where the processor supports it, 16/32 positions are checked at once
+/// </summary>
+/// <param name="from">first position to check</param>
+/// <param name="to">position after the last one to check.
+///   data up to 'to + distance' must be accessible</param>
+/// <param name="first">the first byte of the lexeme</param>
+/// <param name="last">the last byte of the lexeme</param>
+/// <param name="distance">lexeme size minus 1</param>
+/// <returns>position of the candidate or 'to' if there is no candidate</returns>
+const char* FindCandidate(const char* from, const char* const to,
+    const char first, const char last, const std::size_t distance);
+
+/// <summary>
+///   compares 2 arrays of data
+/// </summary>
+/// <param name="left">data to compare</param>
+/// <param name="right">data to compare with</param>
+/// <param name="maxLength">size of both arrays</param>
+/// <returns>amount of equal bytes from the beginning of the arrays</returns>
+std::size_t MatchLength(const char* const left, const char* const right, const std::size_t maxLength);
+
+
+/// <summary>
+///   searches for positions where one of the lexemes could begin.
+///     Up to 3 first bytes of all lexemes are checked at once by masks of their
+///     low and high nibbles (Teddy-like). Lexemes are spread among 8 groups, the position
+///     is a candidate if its bytes could be the beginning of a lexeme from any group.
+///     SSSE3/AVX2 is used where the processor supports it, 16/32 positions are checked at once
+/// </summary>
+class LexemeStartFilter final
+{
+public:
+    static constexpr std::size_t maxWidth = 3; // maximum amount of bytes to check at a position
+    static constexpr std::size_t groups = 8;
+
+    /// <summary>
+    ///   masks of groups for the bytes at the positions 0..maxWidth-1 from the checked position
+    /// </summary>
+    struct Masks
+    {
+        alignas(16) unsigned char low_[maxWidth][16]; // by low nibble of the byte
+        alignas(16) unsigned char high_[maxWidth][16]; // by high nibble of the byte
+        unsigned char bytes_[maxWidth][256]; // by the whole byte
+        std::size_t width_ = maxWidth; // amount of bytes to check at a position
+    };
+
+public:
+    /// <summary>
+    ///   builds masks for the lexemes
+    /// </summary>
+    /// <param name="lexemes">not empty lexemes to search for</param>
+    LexemeStartFilter(const std::vector<std::span<const char>>& lexemes);
+
+    /// <summary>
+    ///   amount of bytes checked at each position
+    /// </summary>
+    std::size_t Width() const noexcept
+    {
+        return masks_.width_;
+    }
+
+    /// <summary>
+    ///   looks for the first position where one of the lexemes could begin
+    /// </summary>
+    /// <param name="from">first position to check</param>
+    /// <param name="to">position after the last one to check.
+    ///   data up to 'to + Width() - 1' must be accessible</param>
+    /// <returns>position of the candidate or 'to' if there is no candidate</returns>
+    const char* Find(const char* from, const char* const to) const;
+
+protected:
+    Masks masks_;
+};
+
+};// namespace bpatch
@@ -0,0 +1,389 @@
+#include "stdafx.h"
+#include "choiceautomaton.h"
+
+namespace bpatch
+{
+using namespace std;
+
+ChoiceAutomaton::ChoiceAutomaton(const vector<span<const char>>& lexemes)
+    : lexemes_(lexemes)
+{
+    for (const auto& lexeme : lexemes_)
+    {
+        for (const char c : lexeme)
+        {
+            if (uint16_t& cls = classes_[static_cast<unsigned char>(c)]; 0 == cls)
+            {
+                cls = static_cast<uint16_t>(classesCount_++);
+            }
+        }
+    }
+}
+
+
+uint32_t ChoiceAutomaton::AddState(const uint32_t depth, const uint32_t lexeme)
+{
+    if (states_.size() >= noMatch)
+    {
+        throw logic_error("Too many source lexemes to replace");
+    }
+    states_.push_back({depth, lexeme});
+    return static_cast<uint32_t>(states_.size() - 1);
+}
+
+
+void ChoiceAutomaton::SetFirstMatch(State& child, const State& parent, const uint32_t suffixLexeme) const
+{
+    child.matchLexeme_ = parent.matchLexeme_;
+    child.matchOffset_ = parent.matchOffset_;
+    if (noMatch != suffixLexeme)
+    {
+        const uint32_t offset = child.depth_ - static_cast<uint32_t>(lexemes_[suffixLexeme].size());
+        if (noMatch == child.matchLexeme_ || offset < child.matchOffset_ ||
+            (offset == child.matchOffset_ && suffixLexeme < child.matchLexeme_))
+        {
+            child.matchLexeme_ = suffixLexeme;
+            child.matchOffset_ = offset;
+        }
+    }
+}
+
+
+//--------------------------------------------------
+TableChoiceAutomaton::TableChoiceAutomaton(const vector<span<const char>>& lexemes)
+    : ChoiceAutomaton(lexemes)
+{
+    // trie. 0 in transitions_ means 'no child' at this moment
+    AddState(0, 0);
+    transitions_.assign(classesCount_, 0);
+    vector<uint32_t> terminalLexeme(1, noMatch); // lexeme which ends in the state
+    for (uint32_t i = 0; i < lexemes_.size(); ++i)
+    {
+        const auto& lexeme = lexemes_[i];
+        uint32_t state = 0;
+        for (uint32_t depth = 0; depth < lexeme.size(); ++depth)
+        {
+            const size_t index = state * classesCount_ + Class(lexeme[depth]);
+            if (0 == transitions_[index])
+            {
+                transitions_[index] = AddState(depth + 1, i);
+                terminalLexeme.push_back(noMatch);
+                transitions_.resize(transitions_.size() + classesCount_, 0);
+            }
+            state = transitions_[index];
+        }
+        if (noMatch == terminalLexeme[state]) // duplicate lexeme has lower priority: never matches
+        {
+            terminalLexeme[state] = i;
+        }
+    }
+
+    // breadth first: failure transitions, full transitions table, and the first matches
+    vector<uint32_t> failure(states_.size(), 0);
+    vector<uint32_t> suffixLexeme(states_.size(), noMatch); // the longest lexeme which ends the data of the state
+    vector<uint32_t> queue(1, 0);
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const uint32_t state = queue[head];
+        for (uint32_t cls = 0; cls < classesCount_; ++cls)
+        {
+            uint32_t& next = transitions_[state * classesCount_ + cls];
+            const uint32_t failureNext = (0 == state) ? 0 : transitions_[failure[state] * classesCount_ + cls];
+            if (0 == next)
+            {
+                next = failureNext;
+                continue;
+            }
+
+            // child of the trie
+            failure[next] = failureNext;
+            suffixLexeme[next] = (noMatch != terminalLexeme[next]) ? terminalLexeme[next] : suffixLexeme[failureNext];
+            SetFirstMatch(states_[next], states_[state], suffixLexeme[next]);
+            queue.push_back(next);
+        }
+    }
+}
+
+
+size_t TableChoiceAutomaton::EstimateSize(const vector<span<const char>>& lexemes)
+{
+    bool present[256] = {};
+    size_t totalSize = 1;
+    for (const auto& lexeme : lexemes)
+    {
+        totalSize += lexeme.size();
+        for (const char c : lexeme)
+        {
+            present[static_cast<unsigned char>(c)] = true;
+        }
+    }
+    return totalSize * (1 + static_cast<size_t>(count(begin(present), end(present), true))) * sizeof(uint32_t);
+}
+
+
+//--------------------------------------------------
+namespace
+{
+/// <summary>
+///   places transitions of states into double-array: looks for the base of the state,
+///     where cells for all transitions are free. Free cells are linked into list
+/// </summary>
+template <class Cell>
+class DoubleArrayPlacement
+{
+    static constexpr uint32_t noCell = numeric_limits<uint32_t>::max();
+
+    // the first free cell is skipped after this amount of unsuccessful tries
+    static constexpr uint32_t maxTriesOfFirstFree = 16;
+
+    // free cells checked for one state; the state is placed after all cells then
+    static constexpr uint32_t maxCellsToCheck = 256;
+
+public:
+    DoubleArrayPlacement(vector<Cell>& cells)
+        : cells_(cells)
+        , usedSize_(static_cast<uint32_t>(cells.size()))
+    {
+        Grow(cells_.size());
+    }
+
+    /// <summary>
+    ///   looks for the base where cells for all classes are free and takes the cells
+    /// </summary>
+    /// <param name="classes">classes of transitions in ascending order</param>
+    /// <param name="parent">state to take the cells for</param>
+    /// <returns>the base</returns>
+    uint32_t Place(const vector<uint32_t>& classes, const uint32_t parent)
+    {
+        uint32_t base = noCell;
+        uint32_t checked = 0;
+        for (uint32_t cell = firstFree_; noCell != cell && checked < maxCellsToCheck; ++checked)
+        {
+            if (cell >= classes.front() && AllFree(cell - classes.front(), classes))
+            {
+                base = cell - classes.front();
+                break;
+            }
+            const uint32_t next = next_[cell];
+            if (cell == firstFree_ && ++triesOfFirstFree_ >= maxTriesOfFirstFree)
+            {
+                Unlink(cell); // the first free cell is hard to use: it stays free forever
+            }
+            cell = next;
+        }
+
+        if (noCell == base)
+        {// after all used cells
+            base = max(usedSize_, classes.front()) - classes.front();
+        }
+
+        if (const size_t required = static_cast<size_t>(base) + classes.back() + 1; required > cells_.size())
+        {
+            if (required >= noCell)
+            {
+                throw logic_error("Too many source lexemes to replace");
+            }
+            Grow(max(required, cells_.size() + cells_.size() / 4));
+        }
+
+        for (const uint32_t cls : classes)
+        {
+            const uint32_t cell = base + cls;
+            cells_[cell].check_ = parent;
+            Unlink(cell);
+        }
+        usedSize_ = max(usedSize_, base + classes.back() + 1);
+        return base;
+    }
+
+    /// <summary>
+    ///   the amount of cells which are used
+    /// </summary>
+    size_t UsedSize() const noexcept
+    {
+        return usedSize_;
+    }
+
+protected:
+    bool AllFree(const uint32_t base, const vector<uint32_t>& classes) const
+    {
+        for (const uint32_t cls : classes)
+        {
+            if (const size_t cell = static_cast<size_t>(base) + cls; cell < cells_.size() && noCell != cells_[cell].check_)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Grow(const size_t newSize)
+    {
+        const size_t oldSize = next_.size();
+        cells_.resize(newSize);
+        next_.resize(newSize, noCell);
+        prev_.resize(newSize, noCell);
+        for (size_t i = oldSize; i < newSize; ++i)
+        {
+            if (noCell != cells_[i].check_)
+            {
+                continue; // already used
+            }
+            const uint32_t cell = static_cast<uint32_t>(i);
+            prev_[cell] = lastFree_;
+            if (noCell == lastFree_)
+            {
+                firstFree_ = cell;
+            }
+            else
+            {
+                next_[lastFree_] = cell;
+            }
+            lastFree_ = cell;
+        }
+    }
+
+    void Unlink(const uint32_t cell)
+    {
+        const uint32_t prev = prev_[cell];
+        const uint32_t next = next_[cell];
+        if (noCell == prev)
+        {
+            if (firstFree_ != cell)
+            {
+                return; // not in the list
+            }
+            firstFree_ = next;
+            triesOfFirstFree_ = 0;
+        }
+        else
+        {
+            next_[prev] = next;
+        }
+        (noCell == next ? lastFree_ : prev_[next]) = prev;
+        next_[cell] = prev_[cell] = noCell;
+    }
+
+protected:
+    vector<Cell>& cells_;
+    vector<uint32_t> next_; // next free cell
+    vector<uint32_t> prev_; // previous free cell
+    uint32_t firstFree_ = noCell;
+    uint32_t lastFree_ = noCell;
+    uint32_t triesOfFirstFree_ = 0;
+    uint32_t usedSize_; // cells after this one are free
+};
+
+};
+
+
+DoubleArrayChoiceAutomaton::DoubleArrayChoiceAutomaton(const vector<span<const char>>& lexemes)
+    : ChoiceAutomaton(lexemes)
+{
+    // lexemes with the same beginning are neighbours after sorting; duplicates stay in order of priority
+    vector<uint32_t> sorted(lexemes_.size());
+    for (uint32_t i = 0; i < sorted.size(); ++i)
+    {
+        sorted[i] = i;
+    }
+    stable_sort(sorted.begin(), sorted.end(), [this](const uint32_t left, const uint32_t right)
+        {
+            return lexicographical_compare(lexemes_[left].begin(), lexemes_[left].end(),
+                lexemes_[right].begin(), lexemes_[right].end());
+        });
+
+    // state and the range of sorted lexemes which begin with the data of the state
+    struct Node
+    {
+        uint32_t state;
+        uint32_t begin;
+        uint32_t end;
+    };
+    vector<Node> queue;
+    queue.push_back({0, 0, static_cast<uint32_t>(sorted.size())});
+
+    cells_.resize(1);
+    cells_[0].check_ = 0; // root is not free
+    DoubleArrayPlacement<Cell> placement(cells_);
+    states_.resize(1);
+    vector<uint32_t> suffixLexeme(1, noMatch); // the longest lexeme which ends the data of the state
+
+    // breadth first: double-array trie, failure transitions, and the first matches
+    vector<uint32_t> classes;
+    vector<Node> children;
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const Node node = queue[head];
+        const uint32_t depth = states_[node.state].depth_;
+
+        // lexemes which end in the state are the first in the range
+        uint32_t from = node.begin;
+        while (from < node.end && lexemes_[sorted[from]].size() == depth)
+        {
+            ++from;
+        }
+
+        classes.clear();
+        children.clear();
+        while (from < node.end)
+        {
+            const char c = lexemes_[sorted[from]][depth];
+            uint32_t to = from + 1;
+            while (to < node.end && lexemes_[sorted[to]][depth] == c)
+            {
+                ++to;
+            }
+            classes.push_back(Class(c));
+            children.push_back({0, from, to});
+            from = to;
+        }
+        if (children.empty())
+        {
+            continue;
+        }
+
+        // children are placed in ascending order of classes
+        vector<size_t> byClass(children.size());
+        for (size_t i = 0; i < byClass.size(); ++i)
+        {
+            byClass[i] = i;
+        }
+        sort(byClass.begin(), byClass.end(), [&classes](const size_t l, const size_t r) { return classes[l] < classes[r]; });
+        vector<uint32_t> sortedClasses(classes.size());
+        for (size_t i = 0; i < byClass.size(); ++i)
+        {
+            sortedClasses[i] = classes[byClass[i]];
+        }
+
+        const uint32_t base = placement.Place(sortedClasses, node.state);
+        cells_[node.state].base_ = base;
+        states_.resize(cells_.size());
+        suffixLexeme.resize(cells_.size(), noMatch);
+
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            Node& child = children[i];
+            child.state = base + classes[i];
+            const uint32_t firstLexeme = sorted[child.begin];
+            State& childState = states_[child.state];
+            childState.depth_ = depth + 1;
+            childState.lexeme_ = firstLexeme;
+
+            const char c = lexemes_[firstLexeme][depth];
+            const uint32_t failure = (0 == node.state) ? 0 : Transition(cells_[node.state].failure_, c);
+            cells_[child.state].failure_ = failure;
+
+            // lexeme which ends in the child is the first in its range
+            suffixLexeme[child.state] = (lexemes_[firstLexeme].size() == depth + 1) ? firstLexeme : suffixLexeme[failure];
+            SetFirstMatch(childState, states_[node.state], suffixLexeme[child.state]);
+            queue.push_back(child);
+        }
+    }
+
+    cells_.resize(placement.UsedSize());
+    cells_.shrink_to_fit();
+    states_.resize(cells_.size());
+    states_.shrink_to_fit();
+}
+
+};// namespace bpatch
@@ -0,0 +1,168 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace bpatch
+{
+/// <summary>
+///   Aho-Corasick automaton over lexemes for the choice of the lexeme to replace.
+///     Data represented by a state is the longest end of the processed data which could still
+///     be the beginning of a lexeme. Each state knows the first match inside its data:
+///     the leftmost one, and the lexeme with lower index among matches at the same position.
+///   Root state is 0. Bytes which are not present in lexemes share class 0
+/// </summary>
+class ChoiceAutomaton
+{
+public:
+    static constexpr uint32_t noMatch = std::numeric_limits<uint32_t>::max();
+
+    struct State
+    {
+        uint32_t depth_ = 0; // length of the data represented by the state
+        uint32_t lexeme_ = 0; // the data is the beginning of this lexeme
+        uint32_t matchLexeme_ = noMatch; // lexeme of the first match inside of the data
+        uint32_t matchOffset_ = 0; // where the first match begins in the data
+    };
+
+public:
+    const State& operator[](const uint32_t state) const noexcept
+    {
+        return states_[state];
+    }
+
+    /// <summary>
+    ///   data represented by the state. It is located in the lexeme
+    /// </summary>
+    /// <param name="state">index of the state</param>
+    /// <returns>the data</returns>
+    std::span<const char> StateData(const uint32_t state) const noexcept
+    {
+        return lexemes_[states_[state].lexeme_].subspan(0, states_[state].depth_);
+    }
+
+protected:
+    /// <summary>
+    ///   assigns classes to bytes of lexemes
+    /// </summary>
+    /// <param name="lexemes">not empty lexemes in order of priority</param>
+    ChoiceAutomaton(const std::vector<std::span<const char>>& lexemes);
+
+    /// <summary>
+    ///   class of the byte
+    /// </summary>
+    uint32_t Class(const char c) const noexcept
+    {
+        return classes_[static_cast<unsigned char>(c)];
+    }
+
+    /// <summary>
+    ///   adds new state; throws if there are too many states
+    /// </summary>
+    /// <returns>index of the new state</returns>
+    uint32_t AddState(const uint32_t depth, const uint32_t lexeme);
+
+    /// <summary>
+    ///   sets the first match of the child state: it is either inside of the data of the parent,
+    ///     or it is the longest lexeme which ends the data of the child
+    /// </summary>
+    /// <param name="child">state to set the match for</param>
+    /// <param name="parent">parent of the child in the trie</param>
+    /// <param name="suffixLexeme">the longest lexeme ending the data of the child; noMatch if none</param>
+    void SetFirstMatch(State& child, const State& parent, const uint32_t suffixLexeme) const;
+
+protected:
+    std::vector<std::span<const char>> lexemes_;
+    std::vector<State> states_;
+
+    uint16_t classes_[256] = {};
+    uint32_t classesCount_ = 1;
+};
+
+
+/// <summary>
+///   automaton with the full transitions table; for moderate sets of lexemes
+/// </summary>
+class TableChoiceAutomaton final : public ChoiceAutomaton
+{
+public:
+    /// <summary>
+    ///   builds trie, failure transitions, full transitions table, and the first matches
+    /// </summary>
+    /// <param name="lexemes">not empty lexemes in order of priority</param>
+    TableChoiceAutomaton(const std::vector<std::span<const char>>& lexemes);
+
+    /// <summary>
+    ///   index of the state after the transition
+    /// </summary>
+    uint32_t Transition(const uint32_t state, const char c) const noexcept
+    {
+        return transitions_[state * classesCount_ + Class(c)];
+    }
+
+    /// <summary>
+    ///   estimates memory for the transitions table of the lexemes
+    /// </summary>
+    /// <param name="lexemes">lexemes for the automaton</param>
+    /// <returns>size in bytes</returns>
+    static std::size_t EstimateSize(const std::vector<std::span<const char>>& lexemes);
+
+protected:
+    // transitions_[state * classesCount_ + class] is the next state
+    std::vector<uint32_t> transitions_;
+};
+
+
+/// <summary>
+///   automaton with the trie in double-array and failure transitions; for huge sets of lexemes.
+///     Memory is few integers per state, transitions of a state are placed near each other
+/// </summary>
+class DoubleArrayChoiceAutomaton final : public ChoiceAutomaton
+{
+    static constexpr uint32_t noState = std::numeric_limits<uint32_t>::max();
+
+    struct Cell
+    {
+        uint32_t base_ = 0; // transition by class c goes to the cell base_ + c
+        uint32_t check_ = noState; // parent state of the cell; noState for free cell
+        uint32_t failure_ = 0; // state for the longest end of the data which is in trie
+    };
+
+public:
+    /// <summary>
+    ///   builds double-array trie, failure transitions, and the first matches
+    /// </summary>
+    /// <param name="lexemes">not empty lexemes in order of priority</param>
+    DoubleArrayChoiceAutomaton(const std::vector<std::span<const char>>& lexemes);
+
+    /// <summary>
+    ///   index of the state after the transition
+    /// </summary>
+    uint32_t Transition(uint32_t state, const char c) const noexcept
+    {
+        const uint32_t cls = Class(c);
+        if (0 == cls)
+        {
+            return 0; // byte is not present in lexemes
+        }
+        for (;;)
+        {
+            const Cell& cell = cells_[state];
+            if (const uint32_t next = cell.base_ + cls; next < cells_.size() && cells_[next].check_ == state)
+            {
+                return next;
+            }
+            if (0 == state)
+            {
+                return 0;
+            }
+            state = cell.failure_;
+        }
+    }
+
+protected:
+    std::vector<Cell> cells_; // states are indexes of cells
+};
+
+};// namespace bpatch
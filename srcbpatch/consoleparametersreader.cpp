@@ -5,7 +5,8 @@
 namespace
 {
     constexpr const char* const manualText =
-R"(bpatch -s SOURCE -a ACTIONS [-d/-w DEST] [-fa AFN] [-fb BFFN]
+R"(bpatch -s SOURCE -a ACTIONS [-d/-w DEST] [-fa AFN] [-fb BFFN] [-fuse STATES]
+       [-direct]
   -s SOURCE       SOURCE file data will be changed (as binary data)
   -a ACTIONS      according rules picked from ACTIONS file
   -d DEST         result data will be saved into DEST file if this
@@ -27,6 +28,17 @@ R"(bpatch -s SOURCE -a ACTIONS [-d/-w DEST] [-fa AFN] [-fb BFFN]
   -fa             for Actions Folder Name: AFN
   -fb             for Binary Files Folder Name: BFFN
 
+  "replace" objects are applied one by one. Consecutive dense
+  replaces of short lexemes could be faster composed into one
+  transducer. Use:
+  -fuse STATES    to compose them while the transducer has not
+                  more than STATES states (1024 is reasonable)
+
+  Files are read and written through the page cache of the system.
+  For huge files, which should not evict cached data of other
+  processes, use (Linux only):
+  -direct         to read and write files bypassing the page cache
+
   ACTIONS file sample:
           proven for ASCII symbols, json format
           note: control characters in text cannot be unicode!
@@ -165,6 +177,21 @@ bool ConsoleParametersReader::ReadConsoleParameters(int argc, char* argv[])
         FolderBinaryPatterns() = value;
     }
 
+    if (readParameter("-fuse", value)) // set the limit of states of composed replaces if provided
+    {
+        if (const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), sData.maxFusedStates);
+            ec != std::errc() || ptr != value.data() + value.size())
+        {
+            return false; // not a number
+        }
+    }
+
+    // bypass the page cache if requested
+    sData.direct = std::ranges::any_of(params, [](const std::string_view& sv) noexcept -> bool
+        {
+            return std::ranges::equal(sv, std::string_view("-direct"), ichar_equals);
+        });
+
     readParameter("-s", sData.source);
     if (sData.forceOverwrite = readParameter("-w", sData.target); !sData.forceOverwrite)
     {
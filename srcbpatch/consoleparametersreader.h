@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <string_view>
 
 namespace bpatch
@@ -42,6 +43,14 @@ public:
     /// <returns> returns true if we need to overwrite Target file </returns>
     bool Overwrite() const noexcept { return sData.forceOverwrite; };
 
+    /// <summary> returns limit of states for consecutive replaces composed together </summary>
+    /// <returns> limit of states; 0 if replaces are applied one by one </returns>
+    std::size_t MaxFusedStates() const noexcept { return sData.maxFusedStates; };
+
+    /// <summary> returns true if files are read and written bypassing the page cache </summary>
+    /// <returns> returns true if the page cache is bypassed </returns>
+    bool Direct() const noexcept { return sData.direct; };
+
 // members
 protected:
     const char * const manualText;
@@ -51,6 +60,8 @@ protected:
         std::string_view target;
         std::string_view actions;
         bool forceOverwrite = false;
+        std::size_t maxFusedStates = 0; // 'replace' objects are applied one by one by default
+        bool direct = false;
     } sData;
 };
 
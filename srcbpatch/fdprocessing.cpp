@@ -0,0 +1,644 @@
+#include "stdafx.h"
+#include "fdprocessing.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char* const fd_errors[] =
+    {
+        "Failed to open file." // 0
+        , "Failed to write a file." // 1
+        , "Failed to read a file." // 2
+        , "Place is less than a block of data." // 3
+    };
+
+#ifdef BPATCH_IO_URING
+    // amount of buffers of the ring: as many reads or writes could be in flight
+    const unsigned ringBuffers = 4;
+#endif
+
+};
+
+
+namespace bpatch
+{
+using namespace std;
+using namespace std::filesystem;
+
+
+size_t CopyByKernel(const int from, const size_t offset, const int to, loff_t* const toOffset, const size_t size)
+{
+    struct stat st;
+    const bool toPipe = fstat(to, &st) == 0 && S_ISFIFO(st.st_mode);
+
+    size_t copied = 0;
+    while (copied < size)
+    {
+        loff_t fromOffset = static_cast<loff_t>(offset + copied);
+        const ssize_t ret = toPipe ? splice(from, &fromOffset, to, nullptr, size - copied, SPLICE_F_MOVE) :
+            copy_file_range(from, &fromOffset, to, toOffset, size - copied, 0);
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EINVAL == errno || EXDEV == errno || ENOSYS == errno || EOPNOTSUPP == errno || ESPIPE == errno)
+            {// the kernel cannot copy between these files
+                break;
+            }
+            throw filesystem_error(fd_errors[1], error_code(errno, generic_category()));
+        }
+        if (0 == ret)
+        {// end of file
+            break;
+        }
+        copied += static_cast<size_t>(ret);
+    }
+    return copied;
+}
+//------------------------------------------------------
+
+
+FdProcessing::FdProcessing(const char* fname, const int flags, const bool direct)
+{
+    if (direct)
+    {
+        if (fd_ = open(fname, flags | O_CLOEXEC | O_DIRECT, 0666); fd_ >= 0)
+        {
+            alignedHolder_.resize(SZBUFF_FC + directAlignment);
+            void* place = alignedHolder_.data();
+            size_t space = alignedHolder_.size();
+            aligned_ = static_cast<char*>(align(directAlignment, SZBUFF_FC, place, space));
+            return;
+        }
+        dropCache_ = EINVAL == errno; // the file system does not support O_DIRECT
+    }
+
+    if (fd_ = open(fname, flags | O_CLOEXEC, 0666); fd_ < 0)
+    {
+        throw filesystem_error(fd_errors[0], filesystem::path(fname), error_code(errno, generic_category()));
+    }
+
+    // the file is processed from the beginning to the end once: the kernel could read ahead more
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+
+FdProcessing::~FdProcessing()
+{
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+    fd_ = -1;
+}
+
+
+size_t FdProcessing::ReadAt(const span<char> place, const size_t offset) const
+{
+    if (nullptr == aligned_)
+    {
+        const size_t readed = PReadAll(place.data(), place.size(), offset);
+        if (dropCache_)
+        {
+            posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(readed), POSIX_FADV_DONTNEED);
+        }
+        return readed;
+    }
+
+    // O_DIRECT: data goes through the aligned buffer by aligned portions
+    size_t readed = 0;
+    while (readed < place.size())
+    {
+        const size_t portion = min(SZBUFF_FC, place.size() - readed);
+        const size_t toRead = (portion + directAlignment - 1) & ~(directAlignment - 1);
+        const size_t got = PReadAll(aligned_, toRead, offset + readed);
+        memcpy(place.data() + readed, aligned_, min(got, portion));
+        readed += min(got, portion);
+        if (got < toRead)
+        {// end of file
+            break;
+        }
+    }
+    return readed;
+}
+
+
+void FdProcessing::WriteAt(const string_view sv, const size_t offset) const
+{
+    if (nullptr == aligned_)
+    {
+        PWriteAll(sv.data(), sv.size(), offset);
+        if (dropCache_)
+        {// writing back is started here, so pages are dropped as soon as they are written
+            posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(sv.size()), POSIX_FADV_DONTNEED);
+        }
+        return;
+    }
+
+    // O_DIRECT: data goes through the aligned buffer by aligned portions
+    for (size_t written = 0; written < sv.size();)
+    {
+        const size_t portion = min(SZBUFF_FC, sv.size() - written);
+        const size_t toWrite = (portion + directAlignment - 1) & ~(directAlignment - 1);
+        memcpy(aligned_, sv.data() + written, portion);
+        memset(aligned_ + portion, 0, toWrite - portion); // padding of the tail
+        PWriteAll(aligned_, toWrite, offset + written);
+        written += portion;
+    }
+}
+
+
+size_t FdProcessing::PReadAll(char* const data, const size_t size, const size_t offset) const
+{
+    size_t readed = 0;
+    while (readed < size)
+    {
+        const ssize_t ret = pread(fd_, data + readed, size - readed, static_cast<off_t>(offset + readed));
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            throw filesystem_error(fd_errors[2], error_code(errno, generic_category()));
+        }
+        if (0 == ret)
+        {// end of file
+            break;
+        }
+        readed += static_cast<size_t>(ret);
+        if (nullptr != aligned_ && 0 != (readed & (directAlignment - 1)))
+        {// unaligned amount is readed by O_DIRECT at the end of file only
+            break;
+        }
+    }
+    return readed;
+}
+
+
+void FdProcessing::PWriteAll(const char* const data, const size_t size, const size_t offset) const
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        const ssize_t ret = pwrite(fd_, data + written, size - written, static_cast<off_t>(offset + written));
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            throw filesystem_error(fd_errors[1], error_code(errno, generic_category()));
+        }
+        written += static_cast<size_t>(ret);
+    }
+}
+//------------------------------------------------------
+
+
+ReadWriteFdProcessing::ReadWriteFdProcessing(const char* fname, const bool direct)
+    : FdProcessing(fname, O_RDWR, direct)
+{
+}
+
+
+span<char> ReadWriteFdProcessing::ReadData(const span<char> place)
+{
+    const size_t readed = ReadAt(place, readedAmount_);
+    readedAmount_ += readed;
+    eof_ = readed < place.size();
+    return span(place.data(), readed);
+}
+
+
+size_t ReadWriteFdProcessing::WriteCharacter(const char toProcess, const bool aEod)
+{
+    return WriteData(aEod ? span<const char>() : span<const char>(&toProcess, 1), aEod);
+}
+
+
+size_t ReadWriteFdProcessing::WriteData(const span<const char> toProcess, const bool aEod)
+{
+    bool chunkAccumulated = toProcess.empty() ? cache_.RootChunkFull() :
+        cache_.Accumulate(string_view(toProcess.data(), toProcess.size()));
+
+    size_t writtenRet = 0;
+    if (aEod)
+    {
+        // end of data - need to write everything
+        bool dataRemain = true;
+        while (dataRemain)
+        {
+            unique_ptr<FlexibleCache::Chunk> chunk;
+            dataRemain = cache_.Next(chunk);
+            writtenRet += WriteChunk(string_view(chunk->data, chunk->accumulated));
+        }
+        return writtenRet;
+    }
+
+    // full chunks are written while they do not overwrite data which has not been readed yet
+    while (chunkAccumulated && (eof_ || readedAmount_ - writeAt_ >= SZBUFF_FC))
+    {
+        unique_ptr<FlexibleCache::Chunk> chunk;
+        cache_.Next(chunk);
+        writtenRet += WriteChunk(string_view(chunk->data, chunk->accumulated));
+
+        // get status of next chunk if it is accumulted
+        chunkAccumulated = cache_.RootChunkFull();
+    }
+    return writtenRet;
+}
+
+
+size_t ReadWriteFdProcessing::WriteChunk(const string_view sv)
+{
+    WriteAt(sv, writeAt_);
+    writeAt_ += sv.size();
+    return sv.size();
+}
+
+//------------------------------------------------------
+
+
+DirectReadFdProcessing::DirectReadFdProcessing(const char* fname)
+    : FdProcessing(fname, O_RDONLY, true)
+{
+}
+
+
+unique_ptr<Reader> DirectReadFdProcessing::Create(const char* fname)
+{
+    if (struct stat st; stat(fname, &st) == 0 && !S_ISREG(st.st_mode))
+    {// pipes and special files are read as streams
+        return nullptr;
+    }
+    return unique_ptr<Reader>(new DirectReadFdProcessing(fname));
+}
+
+
+span<char> DirectReadFdProcessing::ReadData(const span<char> place)
+{
+    const size_t readed = ReadAt(place, readedAmount_);
+    readedAmount_ += readed;
+    eof_ = readed < place.size();
+    return span(place.data(), readed);
+}
+//------------------------------------------------------
+
+
+DirectWriteFdProcessing::DirectWriteFdProcessing(const char* fname)
+    : FdProcessing(fname, O_WRONLY | O_CREAT | O_TRUNC, true)
+{
+}
+
+
+unique_ptr<Writer> DirectWriteFdProcessing::Create(const char* fname)
+{
+    if (struct stat st; stat(fname, &st) == 0 && !S_ISREG(st.st_mode))
+    {// pipes and special files are written as streams
+        return nullptr;
+    }
+    return unique_ptr<Writer>(new DirectWriteFdProcessing(fname));
+}
+
+
+size_t DirectWriteFdProcessing::WriteCharacter(const char toProcess, const bool aEod)
+{
+    return WriteData(aEod ? span<const char>() : span<const char>(&toProcess, 1), aEod);
+}
+
+
+size_t DirectWriteFdProcessing::WriteData(const span<const char> toProcess, const bool aEod)
+{
+    bool chunkAccumulated = toProcess.empty() ? cache_.RootChunkFull() :
+        cache_.Accumulate(string_view(toProcess.data(), toProcess.size()));
+
+    size_t writtenRet = 0;
+    if (aEod)
+    {
+        // end of data - need to write everything
+        bool dataRemain = true;
+        while (dataRemain)
+        {
+            unique_ptr<FlexibleCache::Chunk> chunk;
+            dataRemain = cache_.Next(chunk);
+            WriteAt(string_view(chunk->data, chunk->accumulated), writeAt_);
+            writeAt_ += chunk->accumulated;
+            writtenRet += chunk->accumulated;
+        }
+
+        // the tail could be written with padding
+        if (ftruncate(fd_, static_cast<off_t>(writeAt_)) != 0)
+        {
+            throw filesystem_error(fd_errors[1], error_code(errno, generic_category()));
+        }
+        return writtenRet;
+    }
+
+    while (chunkAccumulated)
+    {
+        unique_ptr<FlexibleCache::Chunk> chunk;
+        cache_.Next(chunk);
+        WriteAt(string_view(chunk->data, chunk->accumulated), writeAt_);
+        writeAt_ += chunk->accumulated;
+        writtenRet += chunk->accumulated;
+
+        // get status of next chunk if it is accumulted
+        chunkAccumulated = cache_.RootChunkFull();
+    }
+    return writtenRet;
+}
+//------------------------------------------------------
+
+
+MappedReadFdProcessing::MappedReadFdProcessing(const char* fname)
+    : FdProcessing(fname, O_RDONLY)
+{
+}
+
+
+unique_ptr<Reader> MappedReadFdProcessing::MapFile(const char* fname)
+{
+    unique_ptr<MappedReadFdProcessing> reader(new MappedReadFdProcessing(fname));
+
+    struct stat st;
+    if (fstat(reader->fd_, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {// pipes and special files are read by blocks
+        return nullptr;
+    }
+
+    const size_t sz = static_cast<size_t>(st.st_size);
+    void* const mapping = mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, reader->fd_, 0);
+    if (MAP_FAILED == mapping)
+    {
+        return nullptr;
+    }
+    reader->data_ = span<const char>(static_cast<const char*>(mapping), sz);
+
+    // pages are read ahead of processing, and are not needed after it
+    madvise(mapping, sz, MADV_SEQUENTIAL);
+    return reader;
+}
+
+
+MappedReadFdProcessing::~MappedReadFdProcessing()
+{
+    if (!data_.empty())
+    {
+        munmap(const_cast<char*>(data_.data()), data_.size());
+    }
+}
+
+
+span<char> MappedReadFdProcessing::ReadData(const span<char> place)
+{
+    const size_t readed = min(place.size(), data_.size() - readedAmount_);
+    memcpy(place.data(), data_.data() + readedAmount_, readed);
+    readedAmount_ += readed;
+    return span(place.data(), readed);
+}
+
+
+span<const char> MappedReadFdProcessing::ReadBlock(const span<char> place)
+{
+    // the previous block is not needed anymore: its pages are not kept in memory of the process
+    if (const size_t pageMask = static_cast<size_t>(sysconf(_SC_PAGESIZE)) - 1, processed = readedAmount_ & ~pageMask;
+        processed > releasedAmount_)
+    {
+        madvise(const_cast<char*>(data_.data()) + releasedAmount_, processed - releasedAmount_, MADV_DONTNEED);
+        releasedAmount_ = processed;
+    }
+
+    const span<const char> block = data_.subspan(readedAmount_, min(place.size(), data_.size() - readedAmount_));
+    readedAmount_ += block.size();
+    return block;
+}
+
+
+#ifdef BPATCH_IO_URING
+//------------------------------------------------------
+
+
+UringReadFdProcessing::UringReadFdProcessing(const char* fname)
+    : FdProcessing(fname, O_RDONLY)
+    , blocks_(ringBuffers)
+{
+}
+
+
+unique_ptr<Reader> UringReadFdProcessing::Create(const char* fname)
+{
+    unique_ptr<UringReadFdProcessing> reader(new UringReadFdProcessing(fname));
+
+    struct stat st;
+    if (fstat(reader->fd_, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {// pipes and special files are read by blocks
+        return nullptr;
+    }
+    reader->size_ = static_cast<size_t>(st.st_size);
+
+    if (reader->ring_ = IoRing::Create(ringBuffers, SZBUFF_FC); nullptr == reader->ring_)
+    {
+        return nullptr;
+    }
+
+    for (unsigned i = 0; i < ringBuffers; ++i)
+    {
+        reader->SubmitNext(i);
+    }
+    return reader;
+}
+
+
+void UringReadFdProcessing::SubmitNext(const unsigned index)
+{
+    if (submittedAmount_ >= size_)
+    {
+        return;
+    }
+
+    const size_t toRead = min(SZBUFF_FC, size_ - submittedAmount_);
+    ring_->Submit(false, fd_, index, toRead, submittedAmount_);
+    blocks_[index] = {submittedAmount_, toRead};
+    submittedAmount_ += toRead;
+}
+
+
+span<char> UringReadFdProcessing::ReadData(const span<char> place)
+{
+    const span<const char> block = ReadBlock(place);
+    if (block.size() > place.size())
+    {
+        throw logic_error(fd_errors[3]);
+    }
+    memcpy(place.data(), block.data(), block.size());
+    return span(place.data(), block.size());
+}
+
+
+span<const char> UringReadFdProcessing::ReadBlock(const span<char>)
+{
+    if (readedAmount_ > 0)
+    {// the previous block is processed: its buffer is free
+        SubmitNext((next_ + ringBuffers - 1) % ringBuffers);
+    }
+
+    if (FileReaded() || !ring_->InFlight(next_))
+    {
+        return span<const char>();
+    }
+
+    const int ret = ring_->Wait(next_);
+    if (ret < 0)
+    {
+        throw filesystem_error(fd_errors[2], error_code(-ret, generic_category()));
+    }
+
+    const auto [offset, toRead] = blocks_[next_];
+    const span<char> buffer = ring_->Buffer(next_).first(toRead);
+    size_t readed = static_cast<size_t>(ret);
+    if (readed < toRead)
+    {// short reading - the rest is readed in place
+        readed += ReadAt(buffer.subspan(readed), offset + readed);
+        if (readed < toRead)
+        {// the file was truncated
+            size_ = offset + readed;
+        }
+    }
+
+    readedAmount_ += readed;
+    next_ = (next_ + 1) % ringBuffers;
+    return buffer.first(readed);
+}
+//------------------------------------------------------
+
+
+UringWriteFdProcessing::UringWriteFdProcessing(const char* fname)
+    : FdProcessing(fname, O_WRONLY | O_CREAT | O_TRUNC)
+    , blocks_(ringBuffers)
+{
+}
+
+
+unique_ptr<Writer> UringWriteFdProcessing::Create(const char* fname)
+{
+    if (struct stat st; stat(fname, &st) == 0 && !S_ISREG(st.st_mode))
+    {// pipes and special files are written as streams
+        return nullptr;
+    }
+
+    unique_ptr<IoRing> ring = IoRing::Create(ringBuffers, SZBUFF_FC);
+    if (nullptr == ring)
+    {
+        return nullptr;
+    }
+
+    unique_ptr<UringWriteFdProcessing> writer(new UringWriteFdProcessing(fname));
+    writer->ring_ = move(ring);
+    return writer;
+}
+
+
+size_t UringWriteFdProcessing::WriteCharacter(const char toProcess, const bool aEod)
+{
+    return WriteData(aEod ? span<const char>() : span<const char>(&toProcess, 1), aEod);
+}
+
+
+size_t UringWriteFdProcessing::WriteData(span<const char> toProcess, const bool aEod)
+{
+    size_t writtenRet = 0;
+    while (!toProcess.empty())
+    {
+        const span<char> buffer = ring_->Buffer(current_);
+        const size_t toCopy = min(toProcess.size(), buffer.size() - accumulated_);
+        memcpy(buffer.data() + accumulated_, toProcess.data(), toCopy);
+        accumulated_ += toCopy;
+        toProcess = toProcess.subspan(toCopy);
+
+        if (accumulated_ == buffer.size())
+        {
+            writtenRet += SubmitCurrent();
+        }
+    }
+
+    if (aEod)
+    {
+        // end of data - need to write everything
+        if (accumulated_ > 0)
+        {
+            writtenRet += SubmitCurrent();
+        }
+        for (unsigned i = 0; i < ringBuffers; ++i)
+        {
+            Complete(i);
+        }
+    }
+    return writtenRet;
+}
+
+
+size_t UringWriteFdProcessing::CopyFrom(const int fd, const size_t offset, const size_t size)
+{
+    // data is copied after everything what was accumulated
+    if (accumulated_ > 0)
+    {
+        SubmitCurrent();
+    }
+    for (unsigned i = 0; i < ringBuffers; ++i)
+    {
+        Complete(i);
+    }
+
+    loff_t toOffset = static_cast<loff_t>(writeAt_);
+    const size_t copied = CopyByKernel(fd, offset, fd_, &toOffset, size);
+    writeAt_ += copied;
+    return copied;
+}
+
+
+size_t UringWriteFdProcessing::SubmitCurrent()
+{
+    const size_t submitted = accumulated_;
+    ring_->Submit(true, fd_, current_, submitted, writeAt_);
+    blocks_[current_] = {writeAt_, submitted};
+    writeAt_ += submitted;
+    accumulated_ = 0;
+
+    // the next buffer is free when its writing is done
+    current_ = (current_ + 1) % ringBuffers;
+    Complete(current_);
+    return submitted;
+}
+
+
+void UringWriteFdProcessing::Complete(const unsigned index)
+{
+    if (!ring_->InFlight(index))
+    {
+        return;
+    }
+
+    const int ret = ring_->Wait(index);
+    if (ret < 0)
+    {
+        throw filesystem_error(fd_errors[1], error_code(-ret, generic_category()));
+    }
+
+    if (const auto [offset, toWrite] = blocks_[index]; static_cast<size_t>(ret) < toWrite)
+    {// short writing - the rest is written in place
+        const span<char> buffer = ring_->Buffer(index);
+        WriteAt(string_view(buffer.data() + ret, toWrite - ret), offset + ret);
+    }
+}
+#endif // BPATCH_IO_URING
+
+};// namespace bpatch
+#endif // __linux__
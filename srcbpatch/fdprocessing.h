@@ -0,0 +1,455 @@
+#pragma once
+#include "fileprocessing.h"
+#include "ioring.h"
+
+#ifdef __linux__
+#include <sys/types.h>
+
+namespace bpatch
+{
+/// <summary>
+///   copies data between files by the kernel: by copy_file_range(2), or by splice(2) into a pipe
+/// </summary>
+/// <param name="from">descriptor of the file to copy from</param>
+/// <param name="offset">position of the data in the file to copy from</param>
+/// <param name="to">descriptor of the file to copy to</param>
+/// <param name="toOffset">position to copy to, it is moved after the copied data;
+///   nullptr to copy to the current position of the file</param>
+/// <param name="size">amount of data to copy</param>
+/// <returns>amount of copied data. less than size if the kernel cannot copy these files; throws in case of error</returns>
+size_t CopyByKernel(const int from, const size_t offset, const int to, loff_t* const toOffset, const size_t size);
+
+
+//------------------------------------------------------
+/// <summary>
+///  Class holds file descriptor.
+///      closes it in the destructor
+/// </summary>
+class FdProcessing
+{
+    FdProcessing(const FdProcessing&) = delete;
+    FdProcessing& operator=(const FdProcessing&) = delete;
+    FdProcessing(FdProcessing&&) = delete;
+    FdProcessing& operator=(FdProcessing&&) = delete;
+public:
+
+    /// <summary>
+    ///   opens file with requested flags
+    /// </summary>
+    /// <param name="fname">file name to open</param>
+    /// <param name="flags">flags of file to open. See open(2) documentation</param>
+    /// <param name="direct">true to bypass the page cache. Data goes through the aligned buffer then.
+    ///   If the file system does not support O_DIRECT, pages of processed data are dropped from the cache</param>
+    FdProcessing(const char* fname, const int flags, const bool direct = false);
+
+    /// <summary>
+    ///  closes file here
+    /// </summary>
+    ~FdProcessing();
+
+protected:
+    /// <summary>
+    ///   reads data from the position of the file, until the place is full or the file ends.
+    ///     The position should be aligned to directAlignment if the page cache is bypassed
+    /// </summary>
+    /// <param name="place">place where readed data to hold. and maximum data to read</param>
+    /// <param name="offset">position in the file</param>
+    /// <returns>amount of data readed; throws in case of error</returns>
+    size_t ReadAt(const std::span<char> place, const size_t offset) const;
+
+    /// <summary>
+    ///   writes all data to the position of the file.
+    ///     The position should be aligned to directAlignment if the page cache is bypassed.
+    ///     The unaligned tail is written with zero padding then: the file should be resized after it
+    /// </summary>
+    /// <param name="sv">data to write</param>
+    /// <param name="offset">position in the file</param>
+    /// <returns>throws in case of error</returns>
+    void WriteAt(const std::string_view sv, const size_t offset) const;
+
+    /// <summary>
+    ///   reads data into the memory as pread(2) does, till the size or the end of file
+    /// </summary>
+    /// <returns>amount of data readed; throws in case of error</returns>
+    size_t PReadAll(char* const data, const size_t size, const size_t offset) const;
+
+    /// <summary>
+    ///   writes data from the memory as pwrite(2) does, till the size
+    /// </summary>
+    /// <returns>throws in case of error</returns>
+    void PWriteAll(const char* const data, const size_t size, const size_t offset) const;
+
+public:
+    // alignment of the memory, positions and sizes for O_DIRECT
+    constexpr static const size_t directAlignment = 4096;
+
+protected:
+    /// <summary>
+    ///  our descriptor for read or write
+    /// </summary>
+    int fd_ = -1;
+
+    bool dropCache_ = false; // O_DIRECT is not supported: pages of processed data are dropped from the cache
+    std::vector<char> alignedHolder_; // memory of the aligned buffer
+    char* aligned_ = nullptr; // the aligned buffer of SZBUFF_FC if the file is opened with O_DIRECT
+};
+
+
+///------------------------------------------------------
+/// <summary>
+/// Read data from zero position.
+///   Write data from zero position but not further than you have readed.
+///   Reading and writing are done by positions in the file: no seeks and no buffering by stdio
+/// </summary>
+class ReadWriteFdProcessing final : public FdProcessing, public Reader, public Writer
+{
+public:
+
+    /// <summary>
+    ///   opens file for reading/writing
+    /// </summary>
+    /// <param name="fname">file name to read from/write to</param>
+    /// <param name="direct">true to bypass the page cache</param>
+    ReadWriteFdProcessing(const char* fname, const bool direct = false);
+
+
+    /// <summary>
+    ///   Read Data from readedAmount_ position of the file and put it into span
+    /// </summary>
+    /// <param name="place">place where readed data to hold. and maximum data to read</param>
+    /// <returns>the span but with data amount readed</returns>
+    std::span<char> ReadData(const std::span<char> place) override;
+
+    /// <summary>
+    ///   Check if read everything from file
+    /// </summary>
+    /// <returns> true if we read all the data from file</returns>
+    bool FileReaded()const noexcept override {return eof_;}
+
+    /// <summary>
+    ///   how much data we have readed already
+    /// </summary>
+    /// <returns>amount of data already readed from file</returns>
+    size_t Readed() const noexcept override {return readedAmount_;};
+
+
+    size_t WriteCharacter(const char toProcess, const bool aEod) override;
+
+    /// <summary>
+    /// continue writing from writeAt_ always.
+    /// write not later than readedAmount_.
+    /// </summary>
+    /// <param name="toProcess">block of data to add to cache</param>
+    /// <param name="aEod">sign that no more data in the current session
+    ///   to write everything what was cached</param>
+    /// <returns>how may bytes were written into the  file (not chached)</returns>
+    size_t WriteData(const std::span<const char> toProcess, const bool aEod) override;
+
+    size_t Written() const noexcept override {return writeAt_;};
+
+protected:
+    /// <summary>
+    ///   writes the chunk at writeAt_
+    /// </summary>
+    /// <param name="sv"> data to write</param>
+    /// <returns>written amount</returns>
+    size_t WriteChunk(const std::string_view sv);
+
+protected:
+    bool eof_ = false; // if we reached end of file during reading
+    size_t readedAmount_ = 0; // how many bytes we have readed
+    size_t writeAt_ = 0; // now we are writing at
+
+    // we will write to the file only by big chunks or if the data ends
+    // data will be accumulated here
+    FlexibleCache cache_;
+};
+
+
+//------------------------------------------------------
+/// <summary>
+/// Read data from zero position bypassing the page cache
+/// </summary>
+class DirectReadFdProcessing final : public FdProcessing, public Reader
+{
+public:
+    /// <summary>
+    ///   opens the regular file for reading only
+    /// </summary>
+    /// <param name="fname">file name to read</param>
+    /// <returns>the reader; nullptr if the file exists and is not regular</returns>
+    static std::unique_ptr<Reader> Create(const char* fname);
+
+    /// <summary>
+    ///   Read Data from readedAmount_ position of the file and put it into span
+    /// </summary>
+    /// <param name="place">place where readed data to hold. and maximum data to read</param>
+    /// <returns>the span but with data amount readed</returns>
+    std::span<char> ReadData(const std::span<char> place) override;
+
+    /// <summary>
+    ///   Check if read everything from file
+    /// </summary>
+    /// <returns> true if we read all the data from file</returns>
+    bool FileReaded()const noexcept override {return eof_;}
+
+    /// <summary>
+    ///   how much data we have readed already
+    /// </summary>
+    /// <returns>amount of data already readed from file</returns>
+    size_t Readed() const noexcept override {return readedAmount_;};
+
+protected:
+    /// <summary>
+    ///   opens file for reading only
+    /// </summary>
+    /// <param name="fname">file name to read</param>
+    DirectReadFdProcessing(const char* fname);
+
+protected:
+    bool eof_ = false; // if we reached end of file during reading
+    size_t readedAmount_ = 0; // how many bytes we have readed
+};
+
+
+//------------------------------------------------------
+/// <summary>
+/// Write data from zero position bypassing the page cache
+/// </summary>
+class DirectWriteFdProcessing final : public FdProcessing, public Writer
+{
+public:
+    /// <summary>
+    ///   Creates/overwrites file for writing
+    /// </summary>
+    /// <param name="fname">file name to write to</param>
+    /// <returns>the writer; nullptr if the file exists and is not regular</returns>
+    static std::unique_ptr<Writer> Create(const char* fname);
+
+    size_t WriteCharacter(const char toProcess, const bool aEod) override;
+
+    /// <summary>
+    ///   full chunks are written; everything is written and the file is resized to it if aEod
+    /// </summary>
+    /// <param name="toProcess">block of data to add to cache</param>
+    /// <param name="aEod">sign that no more data in the current session
+    ///   to write everything what was cached</param>
+    /// <returns>how may bytes were written into the  file (not chached)</returns>
+    size_t WriteData(const std::span<const char> toProcess, const bool aEod) override;
+
+    size_t Written() const noexcept override {return writeAt_;};
+
+protected:
+    /// <summary>
+    ///   Creates/overwrites file for writing
+    /// </summary>
+    /// <param name="fname">file name to write to</param>
+    DirectWriteFdProcessing(const char* fname);
+
+protected:
+    size_t writeAt_ = 0; // now we are writing at
+
+    // we will write to the file only by big chunks or if the data ends
+    // data will be accumulated here
+    FlexibleCache cache_;
+};
+
+
+//------------------------------------------------------
+/// <summary>
+/// Read data from the file mapped into memory.
+///   Blocks of data are given from the mapping without copying
+/// </summary>
+class MappedReadFdProcessing final : public FdProcessing, public Reader
+{
+public:
+    /// <summary>
+    ///   maps the regular file into memory
+    /// </summary>
+    /// <param name="fname">file name to read</param>
+    /// <returns>the reader; nullptr if the file is not regular, is empty or cannot be mapped</returns>
+    static std::unique_ptr<Reader> MapFile(const char* fname);
+
+    /// <summary>
+    ///   unmaps the file
+    /// </summary>
+    ~MappedReadFdProcessing();
+
+    /// <summary>
+    ///   Copies data from readedAmount_ position of the mapping into span
+    /// </summary>
+    /// <param name="place">place where readed data to hold. and maximum data to read</param>
+    /// <returns>the span but with data amount readed</returns>
+    std::span<char> ReadData(const std::span<char> place) override;
+
+    /// <summary>
+    ///   Gives the next block from the mapping. Pages of previous blocks are released
+    /// </summary>
+    /// <param name="place">maximum data to read</param>
+    /// <returns>the block of data; it is valid till the next reading</returns>
+    std::span<const char> ReadBlock(const std::span<char> place) override;
+
+    int Descriptor() const noexcept override {return fd_;}
+
+    /// <summary>
+    ///   Check if read everything from file
+    /// </summary>
+    /// <returns> true if we read all the data from file</returns>
+    bool FileReaded()const noexcept override {return readedAmount_ == data_.size();}
+
+    /// <summary>
+    ///   how much data we have readed already
+    /// </summary>
+    /// <returns>amount of data already readed from file</returns>
+    size_t Readed() const noexcept override {return readedAmount_;};
+
+protected:
+    /// <summary>
+    ///   opens file for reading only
+    /// </summary>
+    /// <param name="fname">file name to open</param>
+    MappedReadFdProcessing(const char* fname);
+
+protected:
+    std::span<const char> data_; // the whole file
+    size_t readedAmount_ = 0; // how many bytes we have readed
+    size_t releasedAmount_ = 0; // pages of this amount of data are released
+};
+
+
+#ifdef BPATCH_IO_URING
+//------------------------------------------------------
+/// <summary>
+/// Read data of the regular file through io_uring.
+///   Reading of several blocks ahead is in flight while the data is processed
+/// </summary>
+class UringReadFdProcessing final : public FdProcessing, public Reader
+{
+public:
+    /// <summary>
+    ///   opens the regular file and starts reading of first blocks
+    /// </summary>
+    /// <param name="fname">file name to read</param>
+    /// <returns>the reader; nullptr if the file is not regular, is empty or io_uring is not available</returns>
+    static std::unique_ptr<Reader> Create(const char* fname);
+
+    /// <summary>
+    ///   Copies the next block into span
+    /// </summary>
+    /// <param name="place">place where readed data to hold. it should be not less than SZBUFF_FC</param>
+    /// <returns>the span but with data amount readed</returns>
+    std::span<char> ReadData(const std::span<char> place) override;
+
+    /// <summary>
+    ///   Gives the next block from the buffer of the ring. Reading of further data goes
+    ///     into the buffer of the previous block. Blocks are of SZBUFF_FC
+    /// </summary>
+    /// <param name="place">not used</param>
+    /// <returns>the block of data; it is valid till the next reading</returns>
+    std::span<const char> ReadBlock(const std::span<char> place) override;
+
+    int Descriptor() const noexcept override {return fd_;}
+
+    /// <summary>
+    ///   Check if read everything from file
+    /// </summary>
+    /// <returns> true if we read all the data from file</returns>
+    bool FileReaded()const noexcept override {return readedAmount_ >= size_;}
+
+    /// <summary>
+    ///   how much data we have readed already
+    /// </summary>
+    /// <returns>amount of data already readed from file</returns>
+    size_t Readed() const noexcept override {return readedAmount_;};
+
+protected:
+    /// <summary>
+    ///   opens file for reading only
+    /// </summary>
+    /// <param name="fname">file name to open</param>
+    UringReadFdProcessing(const char* fname);
+
+    /// <summary>
+    ///   submits reading of the data after submitted one into the buffer
+    /// </summary>
+    /// <param name="index">index of the buffer of the ring</param>
+    void SubmitNext(const unsigned index);
+
+protected:
+    std::unique_ptr<IoRing> ring_;
+    std::vector<std::pair<size_t, size_t>> blocks_; // offset and size of the block by the buffer
+    size_t size_ = 0; // size of the file
+    size_t submittedAmount_ = 0; // reading of data till here is submitted
+    size_t readedAmount_ = 0; // how many bytes we have readed
+    unsigned next_ = 0; // buffer of the next block
+};
+
+
+//------------------------------------------------------
+/// <summary>
+/// Write data from zero position through io_uring.
+///   Data is accumulated in buffers of the ring. Writing of several full buffers
+///   is in flight while next data is accumulated
+/// </summary>
+class UringWriteFdProcessing final : public FdProcessing, public Writer
+{
+public:
+    /// <summary>
+    ///   Creates/overwrites file for writing
+    /// </summary>
+    /// <param name="fname">file name to write to</param>
+    /// <returns>the writer; nullptr if the file exists and is not regular or io_uring is not available</returns>
+    static std::unique_ptr<Writer> Create(const char* fname);
+
+    size_t WriteCharacter(const char toProcess, const bool aEod) override;
+
+    /// <summary>
+    ///   accumulates the data. Writing of full buffers is submitted
+    /// </summary>
+    /// <param name="toProcess">block of data to write</param>
+    /// <param name="aEod">sign that no more data in the current session
+    ///   to write everything and to wait till it is written</param>
+    /// <returns>how may bytes were submitted for writing into the file (not accumulated)</returns>
+    size_t WriteData(const std::span<const char> toProcess, const bool aEod) override;
+
+    /// <summary>
+    ///   waits for writing of accumulated data, and copies data of the file after it
+    /// </summary>
+    /// <param name="fd">descriptor of the file to copy from</param>
+    /// <param name="offset">position of the data in the file</param>
+    /// <param name="size">amount of data to copy</param>
+    /// <returns>amount of copied data</returns>
+    size_t CopyFrom(const int fd, const size_t offset, const size_t size) override;
+
+    size_t Written() const noexcept override {return writeAt_;};
+
+protected:
+    /// <summary>
+    ///   opens file for writing only
+    /// </summary>
+    /// <param name="fname">file name to open</param>
+    UringWriteFdProcessing(const char* fname);
+
+    /// <summary>
+    ///   submits writing of accumulated data, and takes the next buffer to accumulate
+    /// </summary>
+    /// <returns>amount of data submitted</returns>
+    size_t SubmitCurrent();
+
+    /// <summary>
+    ///   waits for writing of the buffer, writes the rest if the writing was short
+    /// </summary>
+    /// <param name="index">index of the buffer of the ring</param>
+    void Complete(const unsigned index);
+
+protected:
+    std::unique_ptr<IoRing> ring_;
+    std::vector<std::pair<size_t, size_t>> blocks_; // offset and size of the data by the buffer
+    size_t writeAt_ = 0; // writing of data till here is submitted
+    size_t accumulated_ = 0; // amount of data in the current buffer
+    unsigned current_ = 0; // buffer where data is accumulated
+};
+#endif // BPATCH_IO_URING
+
+};// namespace bpatch
+#endif // __linux__
@@ -1,4 +1,5 @@
 #include "stdafx.h"
+#include "fdprocessing.h"
 #include "fileprocessing.h"
 
 namespace
@@ -98,6 +99,41 @@ size_t WriteFileProcessing::WriteCharacter(const char toProcess, const bool aEod
     return WriteEverythingOrFullChunks(aEod);
 }
 
+size_t WriteFileProcessing::WriteData(const span<const char> toProcess, const bool aEod)
+{
+    if (!toProcess.empty())
+    {
+        cache_->Accumulate(string_view(toProcess.data(), toProcess.size()));
+    }
+
+    return WriteEverythingOrFullChunks(aEod);
+}
+
+size_t WriteFileProcessing::CopyFrom([[maybe_unused]] const int fd, [[maybe_unused]] const size_t offset,
+    [[maybe_unused]] const size_t size)
+{
+#ifdef __linux__
+    WriteEverythingOrFullChunks(true);
+    if (fflush(stream_) != 0)
+    {
+        throw filesystem_error(fio_errors[1], error_code());
+    }
+
+    // the data is copied at the position of the stream
+    const size_t copied = CopyByKernel(fd, offset, fileno(stream_), nullptr, size);
+    writeAt_ += copied;
+
+    // the stream takes the position after the copied data; pipes have no position
+    if (fseeko(stream_, 0, SEEK_CUR) != 0 && ESPIPE != errno)
+    {
+        throw filesystem_error(fio_errors[1], error_code(errno, generic_category()));
+    }
+    return copied;
+#else
+    return 0;
+#endif
+}
+
 size_t WriteFileProcessing::Written() const noexcept
 {
     return writeAt_;
@@ -154,23 +190,34 @@ span<char> ReadWriteFileProcessing::ReadData(const span<char> place)
 
 size_t ReadWriteFileProcessing::WriteCharacter(const char toProcess, const bool aEod)
 {
-    SeekSet(false); // writing
+    return WriteData(aEod ? span<const char>() : span<const char>(&toProcess, 1), aEod);
+}
+
+
+size_t ReadWriteFileProcessing::WriteData(const span<const char> toProcess, const bool aEod)
+{
+    bool chunkAccumulated = toProcess.empty() ? cache_->RootChunkFull() :
+        cache_->Accumulate(string_view(toProcess.data(), toProcess.size()));
 
     if (aEod)
     {
         // end of data - need to write everything
+        SeekSet(false); // writing
         return WriteFileProcessing::WriteEverythingOrFullChunks(aEod);
     }
 
-    bool chunkAccumulated = cache_->Accumulate(toProcess);
     if (!chunkAccumulated)
     {
         return 0;
     }
 
     size_t writtenRet = 0;
-
     size_t maxToWrite = FileReaded() ? SZBUFF_FC : readedAmount_ - Written();
+    if (maxToWrite >= SZBUFF_FC)
+    {
+        SeekSet(false); // writing
+    }
+
     while (maxToWrite >= SZBUFF_FC && chunkAccumulated)
     {
         unique_ptr<FlexibleCache::Chunk> chunk;
@@ -30,6 +30,28 @@ public:
     virtual std::span<char> ReadData(const std::span<char> place) = 0;
 
 
+    /// <summary>
+    ///   reads next block of data. Reader which holds the data in memory returns
+    ///     the block from there without copying to the place
+    /// </summary>
+    /// <param name="place">place where readed data could be held. and maximum data to read</param>
+    /// <returns>the block of data; it is valid till the next reading</returns>
+    virtual std::span<const char> ReadBlock(const std::span<char> place)
+    {
+        return ReadData(place);
+    }
+
+
+    /// <summary>
+    ///   descriptor of the file which is read. Its data could be copied by the kernel
+    /// </summary>
+    /// <returns>the descriptor; -1 if data is not read from a file by descriptor</returns>
+    virtual int Descriptor() const noexcept
+    {
+        return -1;
+    }
+
+
     /// <summary>
     ///   Check if read everything
     /// </summary>
@@ -69,6 +91,37 @@ public:
     virtual size_t WriteCharacter(const char toProcess, const bool aEod) = 0;
 
 
+    /// <summary>
+    ///   Write block of data to somewhere. Sends data to WriteCharacter by default
+    /// </summary>
+    /// <param name="toProcess">data to write</param>
+    /// <param name="aEod">true if it is end of data after the toProcess block</param>
+    /// <returns>Actually written data. Could be 0 if we just accumulated data</returns>
+    virtual size_t WriteData(const std::span<const char> toProcess, const bool aEod)
+    {
+        size_t written = 0;
+        for (const char c : toProcess)
+        {
+            written += WriteCharacter(c, false);
+        }
+        return aEod ? written + WriteCharacter('\0', true) : written;
+    }
+
+
+    /// <summary>
+    ///   copies data of the file after the written data by the kernel, the data does not
+    ///     pass through memory of the process. Accumulated data is written before
+    /// </summary>
+    /// <param name="fd">descriptor of the file to copy from</param>
+    /// <param name="offset">position of the data in the file</param>
+    /// <param name="size">amount of data to copy</param>
+    /// <returns>amount of copied data. 0 if the kernel cannot copy it</returns>
+    virtual size_t CopyFrom(const int, const size_t, const size_t)
+    {
+        return 0;
+    }
+
+
     /// <summary>
     ///   how much data we have written already
     /// </summary>
@@ -174,6 +227,10 @@ public:
 
     size_t WriteCharacter(const char toProcess, const bool aEod) override;
 
+    size_t WriteData(const std::span<const char> toProcess, const bool aEod) override;
+
+    size_t CopyFrom(const int fd, const size_t offset, const size_t size) override;
+
     size_t Written() const noexcept override; // the only way to get writeAt_
 
 protected:
@@ -239,6 +296,17 @@ public:
     size_t WriteCharacter(const char toProcess, const bool aEod) override;
 
 
+    /// <summary>
+    /// save writeAt_ and continue writing from writeAt_ always.
+    /// write not later than readAt_.
+    /// </summary>
+    /// <param name="toProcess">block of data to add to cache</param>
+    /// <param name="aEod">sign that no more data in the current session
+    ///   to write everything what was cached</param>
+    /// <returns>how may bytes were written into the  file (not chached)</returns>
+    size_t WriteData(const std::span<const char> toProcess, const bool aEod) override;
+
+
 protected:
     /// <summary>
     ///   Set position in file for reading or for writing
@@ -0,0 +1,231 @@
+#include "stdafx.h"
+#include "ioring.h"
+
+#ifdef BPATCH_IO_URING
+#include <atomic>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    const char* const ring_errors[] =
+    {
+        "Failed to submit an operation to io_uring." // 0
+        , "Failed to wait for a completion of io_uring." // 1
+        , "Unexpected completion of io_uring." // 2
+    };
+
+    int io_uring_setup(const unsigned entries, io_uring_params* p)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+    }
+
+    int io_uring_enter(const int fd, const unsigned toSubmit, const unsigned minComplete, const unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    int io_uring_register(const int fd, const unsigned opcode, const void* arg, const unsigned nrArgs)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+    }
+
+    /// <summary>
+    ///   maps the part of the ring into memory
+    /// </summary>
+    /// <returns>the mapping; nullptr in case of error</returns>
+    void* MapRing(const int fd, const std::size_t size, const off_t offset)
+    {
+        void* const mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return MAP_FAILED == mapping ? nullptr : mapping;
+    }
+
+    template <typename T>
+    T* Field(void* ring, const unsigned offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+};
+
+
+namespace bpatch
+{
+using namespace std;
+using namespace std::filesystem;
+
+
+IoRing::IoRing(const unsigned buffers, const size_t bufferSize)
+    : bufferSize_(bufferSize)
+    , memory_(buffers * bufferSize)
+    , inFlight_(buffers, false)
+    , results_(buffers, 0)
+    , iovecs_(buffers)
+{
+}
+
+
+unique_ptr<IoRing> IoRing::Create(const unsigned buffers, const size_t bufferSize)
+{
+    io_uring_params p{};
+    const int fd = io_uring_setup(buffers, &p);
+    if (fd < 0)
+    {// the kernel is old, or io_uring is not allowed
+        return nullptr;
+    }
+
+    unique_ptr<IoRing> ring(new IoRing(buffers, bufferSize));
+    ring->ringFd_ = fd;
+
+    ring->sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    ring->sqesSize_ = p.sq_entries * sizeof(io_uring_sqe);
+    ring->sqRing_ = MapRing(fd, ring->sqRingSize_, IORING_OFF_SQ_RING);
+    ring->cqRing_ = MapRing(fd, ring->cqRingSize_, IORING_OFF_CQ_RING);
+    ring->sqes_ = MapRing(fd, ring->sqesSize_, IORING_OFF_SQES);
+    if (nullptr == ring->sqRing_ || nullptr == ring->cqRing_ || nullptr == ring->sqes_)
+    {
+        return nullptr;
+    }
+
+    ring->sqTail_ = Field<unsigned>(ring->sqRing_, p.sq_off.tail);
+    ring->sqMask_ = *Field<unsigned>(ring->sqRing_, p.sq_off.ring_mask);
+    ring->sqArray_ = Field<unsigned>(ring->sqRing_, p.sq_off.array);
+    ring->cqHead_ = Field<unsigned>(ring->cqRing_, p.cq_off.head);
+    ring->cqTail_ = Field<unsigned>(ring->cqRing_, p.cq_off.tail);
+    ring->cqMask_ = *Field<unsigned>(ring->cqRing_, p.cq_off.ring_mask);
+    ring->cqes_ = Field<void>(ring->cqRing_, p.cq_off.cqes);
+
+    // registered buffers are not mapped by the kernel for each operation;
+    // registration could be refused by the limit of locked memory - then buffers are given by addresses
+    for (unsigned i = 0; i < buffers; ++i)
+    {
+        const span<char> buffer = ring->Buffer(i);
+        ring->iovecs_[i] = {buffer.data(), buffer.size()};
+    }
+    ring->registered_ = 0 == io_uring_register(fd, IORING_REGISTER_BUFFERS, ring->iovecs_.data(), buffers);
+    return ring;
+}
+
+
+IoRing::~IoRing()
+{
+    // the kernel could still use buffers
+    try
+    {
+        for (unsigned i = 0; i < inFlight_.size(); ++i)
+        {
+            if (inFlight_[i])
+            {
+                Wait(i);
+            }
+        }
+    }
+    catch (...)
+    {
+    }
+
+    if (nullptr != sqes_)
+    {
+        munmap(sqes_, sqesSize_);
+    }
+    if (nullptr != cqRing_)
+    {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (nullptr != sqRing_)
+    {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (ringFd_ >= 0)
+    {
+        close(ringFd_); // registered buffers are released with the ring
+    }
+}
+
+
+void IoRing::Submit(const bool write, const int fd, const unsigned index, const size_t length, const size_t offset)
+{
+    if (inFlight_[index])
+    {
+        throw logic_error(ring_errors[0]);
+    }
+
+    const unsigned tail = *sqTail_;
+    const unsigned slot = tail & sqMask_;
+    io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes_)[slot];
+    sqe = io_uring_sqe{};
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.user_data = index;
+    if (registered_)
+    {
+        sqe.opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe.addr = reinterpret_cast<uintptr_t>(Buffer(index).data());
+        sqe.len = static_cast<uint32_t>(length);
+        sqe.buf_index = static_cast<uint16_t>(index);
+    }
+    else
+    {// vectored operations are the oldest ones
+        sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.addr = reinterpret_cast<uintptr_t>(&iovecs_[index]);
+        sqe.len = 1;
+        iovecs_[index] = {Buffer(index).data(), length};
+    }
+    sqArray_[slot] = slot;
+    atomic_ref<unsigned>(*sqTail_).store(tail + 1, memory_order_release);
+
+    for (;;)
+    {
+        const int ret = io_uring_enter(ringFd_, 1, 0, 0);
+        if (1 == ret)
+        {
+            break;
+        }
+        if (ret < 0 && (EINTR == errno || EAGAIN == errno || EBUSY == errno))
+        {
+            continue;
+        }
+        throw filesystem_error(ring_errors[0], error_code(ret < 0 ? errno : EIO, generic_category()));
+    }
+    inFlight_[index] = true;
+}
+
+
+int IoRing::Wait(const unsigned index)
+{
+    while (inFlight_[index])
+    {
+        Complete();
+    }
+    return results_[index];
+}
+
+
+void IoRing::Complete()
+{
+    const unsigned head = *cqHead_;
+    while (atomic_ref<unsigned>(*cqTail_).load(memory_order_acquire) == head)
+    {
+        if (io_uring_enter(ringFd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && EINTR != errno)
+        {
+            throw filesystem_error(ring_errors[1], error_code(errno, generic_category()));
+        }
+    }
+
+    const io_uring_cqe& cqe = static_cast<io_uring_cqe*>(cqes_)[head & cqMask_];
+    const uint64_t index = cqe.user_data;
+    const int res = cqe.res;
+    atomic_ref<unsigned>(*cqHead_).store(head + 1, memory_order_release);
+
+    if (index >= inFlight_.size() || !inFlight_[index])
+    {
+        throw logic_error(ring_errors[2]);
+    }
+    inFlight_[index] = false;
+    results_[index] = res;
+}
+
+};// namespace bpatch
+#endif // BPATCH_IO_URING
@@ -0,0 +1,107 @@
+#pragma once
+#include <memory>
+#include <span>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BPATCH_IO_URING
+#endif
+
+#ifdef BPATCH_IO_URING
+#include <sys/uio.h>
+
+namespace bpatch
+{
+/// <summary>
+///   io_uring over system calls: reads and writes of buffers of the ring are submitted
+///     and completed asynchronously. Buffers are registered in the kernel if it is allowed
+/// </summary>
+class IoRing final
+{
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+    IoRing(IoRing&&) = delete;
+    IoRing& operator=(IoRing&&) = delete;
+public:
+    /// <summary>
+    ///   creates the ring with the buffers
+    /// </summary>
+    /// <param name="buffers">amount of buffers; as many operations could be in flight</param>
+    /// <param name="bufferSize">size of each buffer</param>
+    /// <returns>the ring; nullptr if io_uring is not available</returns>
+    static std::unique_ptr<IoRing> Create(const unsigned buffers, const std::size_t bufferSize);
+
+    /// <summary>
+    ///   waits for operations in flight, and releases the ring
+    /// </summary>
+    ~IoRing();
+
+    std::span<char> Buffer(const unsigned index) noexcept
+    {
+        return std::span<char>(memory_.data() + index * bufferSize_, bufferSize_);
+    }
+
+    /// <summary>
+    ///   submits reading or writing of the buffer
+    /// </summary>
+    /// <param name="write">true to write the buffer, false to read into it</param>
+    /// <param name="fd">file descriptor</param>
+    /// <param name="index">index of the buffer; it should not be in flight</param>
+    /// <param name="length">amount of data to read or write</param>
+    /// <param name="offset">position in the file</param>
+    /// <returns>throws in case of error</returns>
+    void Submit(const bool write, const int fd, const unsigned index, const std::size_t length, const std::size_t offset);
+
+    /// <summary>
+    ///   waits for the operation of the buffer
+    /// </summary>
+    /// <param name="index">index of the buffer in flight</param>
+    /// <returns>result of the operation: amount of data, or negative error code</returns>
+    int Wait(const unsigned index);
+
+    bool InFlight(const unsigned index) const noexcept
+    {
+        return inFlight_[index];
+    }
+
+protected:
+    IoRing(const unsigned buffers, const std::size_t bufferSize);
+
+    /// <summary>
+    ///   takes one completion; waits for it if there is no completion yet
+    /// </summary>
+    /// <returns>throws in case of error</returns>
+    void Complete();
+
+protected:
+    int ringFd_ = -1;
+
+    // rings shared with the kernel
+    void* sqRing_ = nullptr;
+    std::size_t sqRingSize_ = 0;
+    void* cqRing_ = nullptr;
+    std::size_t cqRingSize_ = 0;
+    void* sqes_ = nullptr;
+    std::size_t sqesSize_ = 0;
+
+    // fields of the rings
+    unsigned* sqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned* sqArray_ = nullptr;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    void* cqes_ = nullptr;
+
+    // buffers one after another
+    const std::size_t bufferSize_;
+    std::vector<char> memory_;
+    bool registered_ = false; // buffers are registered: operations with fixed buffers are used
+
+    std::vector<bool> inFlight_; // operation of the buffer is submitted and not completed
+    std::vector<int> results_; // results of completed operations
+    std::vector<iovec> iovecs_; // buffers for vectored operations
+};
+
+};// namespace bpatch
+#endif // BPATCH_IO_URING
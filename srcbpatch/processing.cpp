@@ -3,6 +3,7 @@
 #include "binarylexeme.h"
 #include "bpatchfolders.h"
 #include "consoleparametersreader.h"
+#include "fdprocessing.h"
 #include "fileprocessing.h"
 #include "processing.h"
 #include "timemeasurer.h"
@@ -21,6 +22,8 @@ namespace
         string_view file_target = "";
         string_view file_actions = "";
         bool overwrite = false;
+        size_t maxFusedStates = 0;
+        bool direct = false;
     };
 
     struct FileProcessingInfo
@@ -29,14 +32,17 @@ namespace
         string& src;
         string& dst;
         const bool overwrite;
+        const bool direct;
         size_t readed;
         size_t written;
     };
 
+    // smaller unchanged regions are not worth completing of replaces before them
+    constexpr const size_t minPassThrough = 64 * 1024;
 };
 
 
-unique_ptr<ActionsCollection> CreateActionsFile(string_view actionsFileName)
+unique_ptr<ActionsCollection> CreateActionsFile(string_view actionsFileName, const size_t maxFusedStates)
 {
     vector<char> adata;
     if (!ReadFullFile(adata, actionsFileName.data(), FolderActions()))
@@ -46,7 +52,7 @@ unique_ptr<ActionsCollection> CreateActionsFile(string_view actionsFileName)
 
     // Parsing of todo and lexemes
     // Dictionary will be inside
-    return unique_ptr<ActionsCollection>(new ActionsCollection(move(adata)));
+    return unique_ptr<ActionsCollection>(new ActionsCollection(move(adata), maxFusedStates));
 }
 
 
@@ -68,14 +74,92 @@ void DoReadReplaceWrite(unique_ptr<ActionsCollection>& todo, Reader* const pRead
     vector<char> adata(static_cast<vector<char>::size_type>(SZBUFF_FC));
     const span dataHolder(adata.data(), SZBUFF_FC);
 
+    // unchanged regions of the file are copied by the kernel while the writer is able to do it
+    bool passThrough = pReader->Descriptor() >= 0;
     do
     {
-        auto fullSpan = pReader->ReadData(dataHolder);
+        span<const char> fullSpan = pReader->ReadBlock(dataHolder);
+        size_t offset = pReader->Readed() - fullSpan.size(); // position of the block in the file
 
-        ranges::for_each(fullSpan, [&todo](const char c) {todo->DoReplacements(c, false); });
+        for (span<const char> region; passThrough &&
+            !(region = todo->UnchangedRegion(fullSpan, minPassThrough)).empty();)
+        {
+            // replaces are completed before the region, and start again after it
+            const size_t before = static_cast<size_t>(region.data() - fullSpan.data());
+            todo->DoReplacements(fullSpan.first(before), true);
+            const size_t copied = pWriter->CopyFrom(pReader->Descriptor(), offset + before, region.size());
+
+            passThrough = copied == region.size();
+            fullSpan = fullSpan.subspan(before + copied);
+            offset += before + copied;
+        }
+
+        todo->DoReplacements(fullSpan, false); // whole block at once
 
     } while (!pReader->FileReaded());
-    todo->DoReplacements('e', true); // only 'true' as sign of data end is important here
+    todo->DoReplacements(span<const char>(), true); // no more data
+}
+
+
+/// <summary>
+///   Creates reader of the source file. Regular file is mapped into memory where it is possible,
+///     otherwise it is read through io_uring. Pipes and special files are read as streams
+/// </summary>
+/// <param name="fname">the source file</param>
+/// <param name="direct">true to read bypassing the page cache</param>
+/// <returns>the reader</returns>
+unique_ptr<Reader> CreateFileReader(const string& fname, const bool direct)
+{
+#ifdef __linux__
+    if (direct)
+    {
+        if (unique_ptr<Reader> directReader = DirectReadFdProcessing::Create(fname.c_str()); nullptr != directReader)
+        {
+            return directReader;
+        }
+        return unique_ptr<Reader>(new ReadFileProcessing(fname.c_str())); // pipes and special files
+    }
+    if (unique_ptr<Reader> mapped = MappedReadFdProcessing::MapFile(fname.c_str()); nullptr != mapped)
+    {
+        return mapped;
+    }
+#endif
+#ifdef BPATCH_IO_URING
+    if (unique_ptr<Reader> uring = UringReadFdProcessing::Create(fname.c_str()); nullptr != uring)
+    {
+        return uring;
+    }
+#endif
+    return unique_ptr<Reader>(new ReadFileProcessing(fname.c_str()));
+}
+
+
+/// <summary>
+///   Creates writer of the target file. The file is written through io_uring where it is possible.
+///     Pipes and special files are written as streams
+/// </summary>
+/// <param name="fname">the target file</param>
+/// <param name="direct">true to write bypassing the page cache</param>
+/// <returns>the writer</returns>
+unique_ptr<Writer> CreateFileWriter(const string& fname, const bool direct)
+{
+#ifdef __linux__
+    if (direct)
+    {
+        if (unique_ptr<Writer> directWriter = DirectWriteFdProcessing::Create(fname.c_str()); nullptr != directWriter)
+        {
+            return directWriter;
+        }
+        return unique_ptr<Writer>(new WriteFileProcessing(fname.c_str())); // pipes and special files
+    }
+#endif
+#ifdef BPATCH_IO_URING
+    if (unique_ptr<Writer> uring = UringWriteFdProcessing::Create(fname.c_str()); nullptr != uring)
+    {
+        return uring;
+    }
+#endif
+    return unique_ptr<Writer>(new WriteFileProcessing(fname.c_str()));
 }
 
 
@@ -95,7 +179,11 @@ bool ProcessTheFile(FileProcessingInfo& jobInfo)
     if (0 == jobInfo.src.compare(jobInfo.dst))
     {
         {
+#ifdef __linux__
+            ReadWriteFdProcessing rwProcessing(jobInfo.src.c_str(), jobInfo.direct); // no seeks between reading and writing
+#else
             ReadWriteFileProcessing rwProcessing(jobInfo.src.c_str());
+#endif
             DoReadReplaceWrite(jobInfo.todo, &rwProcessing, &rwProcessing);
             jobInfo.written = rwProcessing.Written();
             jobInfo.readed = rwProcessing.Readed();
@@ -123,13 +211,13 @@ bool ProcessTheFile(FileProcessingInfo& jobInfo)
         return false;
     }
 
-    ReadFileProcessing reader(jobInfo.src.c_str());
-    WriteFileProcessing writer(jobInfo.dst.c_str());
+    unique_ptr<Reader> reader = CreateFileReader(jobInfo.src, jobInfo.direct);
+    unique_ptr<Writer> writer = CreateFileWriter(jobInfo.dst, jobInfo.direct);
 
-    DoReadReplaceWrite(jobInfo.todo, &reader, &writer);
+    DoReadReplaceWrite(jobInfo.todo, reader.get(), writer.get());
     // we do not resize file here because we have opened/created file only for writing
-    jobInfo.written = writer.Written();
-    jobInfo.readed = reader.Readed();
+    jobInfo.written = writer->Written();
+    jobInfo.readed = reader->Readed();
 
     return true;
 }
@@ -151,7 +239,7 @@ bool ProcessFilesByMask(ProcessingInfo& jobInfo)
     /// --------------------------------------------------------
     /// load Actions and initialize processing class
     /// Json parsing is inside
-    unique_ptr<ActionsCollection> todo = CreateActionsFile(jobInfo.file_actions);
+    unique_ptr<ActionsCollection> todo = CreateActionsFile(jobInfo.file_actions, jobInfo.maxFusedStates);
 
     // look up logic for files
     wildcharacters::LookUp lookupMasks; // masked files from command line
@@ -160,7 +248,7 @@ bool ProcessFilesByMask(ProcessingInfo& jobInfo)
     string dstFilename; // destination file name
 
     size_t filesProcessed = 0;
-    FileProcessingInfo fileInfo{.todo = todo, .src = srcFilename, .dst = dstFilename, .overwrite = jobInfo.overwrite};
+    FileProcessingInfo fileInfo{.todo = todo, .src = srcFilename, .dst = dstFilename, .overwrite = jobInfo.overwrite, .direct = jobInfo.direct};
     while (lookupMasks.NextFilenamesPair(srcFilename, dstFilename)) // request file names
     {
         cout << "Source file:          '" << fileInfo.src << "'\n";
@@ -213,7 +301,9 @@ bool Processing(int argc, char* argv[])
             .file_source = parametersReader.Source(),
             .file_target = parametersReader.Target(),
             .file_actions = parametersReader.Actions(),
-            .overwrite = parametersReader.Overwrite()
+            .overwrite = parametersReader.Overwrite(),
+            .maxFusedStates = parametersReader.MaxFusedStates(),
+            .direct = parametersReader.Direct()
         };
 
         retValue = bpatch::ProcessFilesByMask(jobInfo);
@@ -0,0 +1,64 @@
+#pragma once
+
+/// <summary>
+///   SIMD code is compiled for x86-64 only. Functions with AVX2/SSSE3 instructions are
+///     marked with target attributes and called after the check of the processor
+/// </summary>
+#if defined(__x86_64__) || defined(_M_X64)
+#define BPATCH_SIMD_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BPATCH_TARGET_AVX2
+#define BPATCH_TARGET_SSSE3
+#else
+#define BPATCH_TARGET_AVX2 __attribute__((target("avx2")))
+#define BPATCH_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace bpatch
+{
+#ifdef BPATCH_SIMD_X64
+/// <summary>
+///   checks if the processor allows SSSE3 instructions
+/// </summary>
+inline bool SSSE3Supported()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+
+/// <summary>
+///   checks if the processor and the operating system allow AVX2 instructions
+/// </summary>
+inline bool AVX2Supported()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    constexpr int osxsaveAndAvx = (1 << 27) | (1 << 28);
+    if ((info[2] & osxsaveAndAvx) != osxsaveAndAvx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // BPATCH_SIMD_X64
+
+};// namespace bpatch
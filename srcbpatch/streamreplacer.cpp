@@ -1,7 +1,10 @@
 #include "stdafx.h"
 #include "binarylexeme.h"
+#include "candidatesearch.h"
+#include "choiceautomaton.h"
 #include "fileprocessing.h"
 #include "streamreplacer.h"
+#include "transducer.h"
 
 namespace bpatch
 {
@@ -16,16 +19,16 @@ class WriterReplacer final : public StreamReplacer
 public:
     WriterReplacer(Writer* const pWriter): pWriter_(pWriter) {};
 
-    virtual void DoReplacements(const char toProcess, const bool aEod) const override;
+    virtual void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
     virtual void SetNextReplacer(std::unique_ptr<StreamReplacer>&& pNext) override;
 protected:
     Writer* const pWriter_;
 };
 
 
-void WriterReplacer::DoReplacements(const char toProcess, const bool aEod) const
+void WriterReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
 {
-    pWriter_->WriteCharacter(toProcess, aEod);
+    pWriter_->WriteData(toProcess, aEod);
 }
 
 
@@ -60,6 +63,196 @@ public:
 };
 
 
+//--------------------------------------------------
+
+/// <summary>
+///     accumulates output of short lexemes and sends it further in big blocks
+/// </summary>
+class ReplacerWithOutput: public ReplacerWithNext
+{
+protected:
+    ReplacerWithOutput()
+    {
+        output_.reserve(SZBUFF_FC);
+    }
+
+    /// <summary>
+    ///   accumulates target for the output
+    /// </summary>
+    /// <param name="target">the target to send</param>
+    void KeepTarget(const span<const char> target) const
+    {
+        output_.insert(output_.end(), target.begin(), target.end());
+        if (output_.size() >= SZBUFF_FC) [[unlikely]]
+        {
+            SendOutput();
+        }
+    }
+
+    /// <summary>
+    ///   accumulates not replaced data for the output. Long block is sent further as it is
+    /// </summary>
+    /// <param name="from">the beginning of the block</param>
+    /// <param name="to">the end of the block</param>
+    void KeepNotReplaced(const char* const from, const char* const to) const
+    {
+        if (static_cast<size_t>(to - from) < notReplacedToSendAsIs)
+        {
+            output_.insert(output_.end(), from, to);
+            return;
+        }
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(from, to), false);
+    }
+
+    /// <summary>
+    ///   sends accumulated output to next replacers as one block
+    /// </summary>
+    void SendOutput() const
+    {
+        if (!output_.empty())
+        {
+            pNext_->DoReplacements(span<const char>(output_.data(), output_.size()), false);
+            output_.clear();
+        }
+    }
+
+protected:
+    // not replaced data is accumulated when it is shorter
+    static constexpr size_t notReplacedToSendAsIs = 64;
+
+    // output to be sent further as one block
+    mutable vector<char> output_;
+};
+
+
+//--------------------------------------------------
+/// <summary>
+///   common block processing for replacers which look for lexemes in windows of the data:
+///     lexemes crossing the border of blocks are looked for in a small stitched buffer,
+///     the cached tail of the previous block plus the beginning of the next one
+/// </summary>
+class StitchedReplacer: public ReplacerWithOutput
+{
+protected:
+    /// <param name="window">the longest source lexeme</param>
+    StitchedReplacer(const size_t window)
+        : maxSize_(window)
+        , cachedData_(2 * window - 2)
+    {
+    }
+
+public:
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    /// <summary>
+    ///   replaces lexemes which begin before pLimit and end not after pEnd.
+    ///     Keeps all data before the returned position for the output
+    /// </summary>
+    /// <param name="pc">the beginning of the data</param>
+    /// <param name="pLimit">lexemes begin before this position</param>
+    /// <param name="pEnd">the end of the data</param>
+    /// <returns>position of the first not processed byte</returns>
+    virtual const char* Process(const char* pc, const char* const pLimit, const char* const pEnd) const = 0;
+
+    /// <summary>
+    ///   processes the cached tail in the end of the stream. It is not replaced by default
+    /// </summary>
+    /// <param name="pc">the beginning of the data</param>
+    /// <param name="pEnd">the end of the stream</param>
+    virtual void ProcessLast(const char* pc, const char* const pEnd) const
+    {
+        KeepNotReplaced(pc, pEnd);
+    }
+
+    /// <summary>
+    ///   the window for the choice
+    /// </summary>
+    /// <returns>size of the longest source lexeme</returns>
+    static size_t LongestSource(const StreamReplacerChoice& choice)
+    {
+        size_t longest = 0;
+        for (const AbstractLexemesPair& alpair : choice)
+        {
+            longest = max(longest, alpair.first->access().size());
+        }
+        return longest;
+    }
+
+protected:
+    const size_t maxSize_; // the longest source lexeme
+
+    mutable size_t cachedAmount_ = 0; // we cache this amount of data in the cachedData_
+
+    // the tail of previous data which could be the beginning of a lexeme,
+    //   and the beginning of the next block to check lexemes crossing the border
+    mutable vector<char> cachedData_;
+};
+
+
+void StitchedReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    const char* pc = toProcess.data();
+    const char* const pEnd = pc + toProcess.size();
+
+    // set buffer of cached at once
+    char* const pBuffer = cachedData_.data();
+
+    if (cachedAmount_ > 0)
+    {
+        // lexemes which begin in the cached data end in the beginning of the block
+        const size_t taken = min(maxSize_ - 1, toProcess.size());
+        if (taken > 0)
+        {
+            memcpy(pBuffer + cachedAmount_, pc, taken);
+        }
+        const char* const pCachedEnd = pBuffer + cachedAmount_;
+        const char* const pStitchedEnd = pCachedEnd + taken;
+        const char* const pNext = Process(pBuffer, pCachedEnd, pStitchedEnd);
+        if (pNext >= pCachedEnd)
+        {// continue inside of the block
+            pc += pNext - pCachedEnd;
+            cachedAmount_ = 0;
+        }
+        else
+        {// the block is too short: it is in the cache completely
+            cachedAmount_ = static_cast<size_t>(pStitchedEnd - pNext);
+            memmove(pBuffer, pNext, cachedAmount_);
+            pc = pEnd;
+        }
+    }
+
+    if (0 == cachedAmount_)
+    {
+        pc = Process(pc, pEnd, pEnd);
+
+        // tail of the block could be the beginning of a lexeme
+        cachedAmount_ = static_cast<size_t>(pEnd - pc);
+        if (cachedAmount_ > 0)
+        {
+            memcpy(pBuffer, pc, cachedAmount_);
+        }
+    }
+
+    // no more data
+    if (aEod)
+    {
+        ProcessLast(pBuffer, pBuffer + cachedAmount_);
+        cachedAmount_ = 0;
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(), true); // send end of the data further
+        return;
+    }
+    SendOutput();
+}
+
+
 //--------------------------------------------------
 struct ReplacerPairHolder
 {
@@ -75,82 +268,255 @@ struct ReplacerPairHolder
 
 
 //--------------------------------------------------
-class UsualReplacer final : public ReplacerWithNext
+/// <summary>
+///   Replacer for the only pair of lexemes. Knuth-Morris-Pratt search:
+///     partially matched data is always the beginning of the source lexeme,
+///     so it is never cached and is sent further straight from the source lexeme.
+///     The failure function is precomputed for the beginning of the source lexeme only;
+///     borders of longer partial matches are searched in the source lexeme itself
+///   While nothing is matched the search jumps to the possible beginnings of the source lexeme:
+///     short lexemes are searched by candidates, long ones by Boyer-Moore-Horspool
+/// </summary>
+class UsualReplacer final : public ReplacerWithOutput
 {
 public:
     UsualReplacer(unique_ptr<AbstractBinaryLexeme>& src,  // what to replace
         unique_ptr<AbstractBinaryLexeme>& trg)  // with what
         : src_(src->access())
         , trg_(trg->access())
+        , borders_(min(src_.size(), maxBordersTable), 0)
     {
-        cachedData_.resize(src_.size());
+        // borders_[i] is the length of the longest proper prefix of src_[0..i] which is its suffix as well
+        uint32_t border = 0;
+        for (size_t i = 1; i < borders_.size(); ++i)
+        {
+            while (border > 0 && src_[i] != src_[border])
+            {
+                border = borders_[border - 1];
+            }
+            if (src_[i] == src_[border])
+            {
+                ++border;
+            }
+            borders_[i] = border;
+        }
+
+        // shifts_[c] is the distance from the last occurrence of c in src_ (the last byte excluded) to the end of src_
+        if (src_.size() > maxLengthForCandidatesSearch)
+        {
+            fill(begin(shifts_), end(shifts_), src_.size());
+            for (size_t i = 0; i + 1 < src_.size(); ++i)
+            {
+                shifts_[static_cast<unsigned char>(src_[i])] = src_.size() - 1 - i;
+            }
+        }
     }
 
-    void DoReplacements(const char toProcess, const bool aEod) const override;
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    /// <summary>
+    ///   looks for the first position where src_ either begins or could begin in the next blocks of data
+    /// </summary>
+    /// <param name="pc">search from this position</param>
+    /// <param name="pEnd">the end of the block of data</param>
+    /// <returns>the position and the length of src_ matched there.
+    ///   The length is either the full size of src_, or the remainder of the block,
+    ///   or long enough to continue with Knuth-Morris-Pratt search.
+    ///   pEnd is the position if src_ cannot begin in the block</returns>
+    pair<const char*, size_t> FindBeginning(const char* pc, const char* const pEnd) const;
+
+    /// <summary>
+    ///   the longest proper prefix of src_[0..length) which is its suffix as well
+    /// </summary>
+    /// <param name="length">length of the partial match; not 0</param>
+    /// <returns>length of the border</returns>
+    size_t Border(const size_t length) const;
 
 protected:
+    // longer lexemes are searched by Boyer-Moore-Horspool
+    static constexpr size_t maxLengthForCandidatesSearch = 64;
+
+    // the failure function is precomputed for this beginning of the source lexeme at most:
+    //   memory of the replacer does not grow with the length of the source lexeme
+    static constexpr size_t maxBordersTable = 4096;
+
+    // partial match of this length is continued by Knuth-Morris-Pratt search;
+    //   shorter one is just a false candidate
+    static constexpr size_t partialMatchToContinue = 16;
+
     const span<const char>& src_; // what to replace
     const span<const char>& trg_; // with what
 
-    mutable size_t cachedAmount_ = 0; // we cached this amount of data
+    // failure function of the beginning of the source lexeme; precomputed once
+    vector<uint32_t> borders_;
 
-    // this is used to hold temporary data while the logic is 
-    // looking for the new beginning of the cached value
-    mutable vector<char> cachedData_;
+    // bad character shifts of Boyer-Moore-Horspool search
+    size_t shifts_[256];
+
+    mutable size_t matchedAmount_ = 0; // this amount of src_ is matched and has not been sent further yet
 };
 
 
-void UsualReplacer::DoReplacements(const char toProcess, const bool aEod) const
+pair<const char*, size_t> UsualReplacer::FindBeginning(const char* pc, const char* const pEnd) const
 {
-    if (nullptr == pNext_)
+    const size_t srcSize = src_.size();
+    if (static_cast<size_t>(pEnd - pc) >= srcSize)
     {
-        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+        // src_ fits into the block at these positions
+        if (srcSize <= maxLengthForCandidatesSearch)
+        {
+            const char* const candidatesEnd = pEnd - (srcSize - 1);
+            for (; (pc = FindCandidate(pc, candidatesEnd, src_.front(), src_.back(), srcSize - 1)) < candidatesEnd; ++pc)
+            {
+                if (0 == memcmp(pc, src_.data(), srcSize))
+                {
+                    return {pc, srcSize};
+                }
+            }
+        }
+        else
+        {
+            const char* const lastWindow = pEnd - srcSize;
+            while (pc <= lastWindow)
+            {
+                const char last = pc[srcSize - 1];
+                if (last == src_.back())
+                {
+                    if (const size_t matched = MatchLength(pc, src_.data(), srcSize); matched == srcSize || matched >= partialMatchToContinue)
+                    {
+                        return {pc, matched};
+                    }
+                }
+                pc += shifts_[static_cast<unsigned char>(last)];
+            }
+        }
     }
 
-    // no more data
-    // just send cached amount
-    if (aEod)
+    // src_ does not fit into the block at these positions: it could begin here only
+    //   if the rest of the block is the beginning of src_
+    while (pc < pEnd)
     {
-        for (size_t i = 0; i < cachedAmount_; ++i)
+        pc = static_cast<const char*>(memchr(pc, src_.front(), static_cast<size_t>(pEnd - pc)));
+        if (nullptr == pc)
         {
-            pNext_->DoReplacements(src_[i], false);
+            break;
         }
-        cachedAmount_ = 0;
-        pNext_->DoReplacements(toProcess, true);
-        return;
+        const size_t rest = static_cast<size_t>(pEnd - pc);
+        if (const size_t matched = MatchLength(pc, src_.data(), rest); matched == rest || matched >= partialMatchToContinue)
+        {
+            return {pc, matched};
+        }
+        ++pc;
+    }
+    return {pEnd, 0};
+}
+
+
+size_t UsualReplacer::Border(const size_t length) const
+{
+    if (length <= borders_.size())
+    {
+        return borders_[length - 1];
     }
 
-    if (src_[cachedAmount_] == toProcess) // check for match
+    // the border begins where the rest of the partial match is the beginning of src_;
+    //   the first such position gives the longest border
+    const char* const pEnd = src_.data() + length;
+    for (const char* pc = src_.data() + 1; pc < pEnd; ++pc)
     {
-        if (++cachedAmount_ >= src_.size())
-        {// send target - do replacement
-            for (size_t q = 0; q < trg_.size(); ++q) { pNext_->DoReplacements(trg_[q], false); }
-            cachedAmount_ = 0;
+        pc = static_cast<const char*>(memchr(pc, src_.front(), static_cast<size_t>(pEnd - pc)));
+        if (nullptr == pc)
+        {
+            break;
+        }
+        if (0 == memcmp(pc, src_.data(), static_cast<size_t>(pEnd - pc)))
+        {
+            return static_cast<size_t>(pEnd - pc);
         }
-        return;
     }
+    return 0;
+}
 
-    // here:   toProcess is not our char
-    //         lets check for fast track (255/256 probability)
-    if (0 == cachedAmount_)
+
+void UsualReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
     {
-        pNext_->DoReplacements(toProcess, false);
-        return;
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    size_t matched = matchedAmount_;
+    const char* const pEnd = toProcess.data() + toProcess.size();
+    const char* runFrom = toProcess.data(); // not matched data to be sent further as one block
+    const char* pc = runFrom;
+    while (pc < pEnd)
+    {
+        if (0 == matched)
+        {
+            // fast track: everything before the possible beginning of src_ stays in the block of not matched data
+            const auto [pBegin, length] = FindBeginning(pc, pEnd);
+            if (pBegin == pEnd)
+            {
+                break;
+            }
+            KeepNotReplaced(runFrom, pBegin); // match begins - everything before it is not matched
+            pc = runFrom = pBegin + length;
+            if (length == src_.size())
+            {// do replacement
+                KeepTarget(trg_);
+                continue;
+            }
+            matched = length;
+            continue;
+        }
+
+        // here:   some data is matched; runFrom == pc
+        const char toCheck = *pc++;
+        if (src_[matched] != toCheck)
+        {
+            // partial match is broken. Its longest border which can be continued
+            //   with toCheck stays matched; everything before the border is sent further
+            size_t border = matched;
+            do
+            {
+                border = Border(border);
+            } while (border > 0 && src_[border] != toCheck);
+
+            KeepTarget(src_.subspan(0, matched - border));
+            matched = border;
+            if (src_[matched] != toCheck)
+            {
+                runFrom = pc - 1; // nothing is matched; toCheck begins the block of not matched data
+                continue;
+            }
+        }
+
+        if (++matched >= src_.size())
+        {// do replacement
+            KeepTarget(trg_);
+            matched = 0;
+        }
+        runFrom = pc;
     }
 
-    // here:   We have some cached data
-    //         at least 1 char need to be send further
-    //         remaining cached data including toProcess need to be reprocessed for match
+    KeepNotReplaced(runFrom, pEnd);
+    matchedAmount_ = matched;
 
-    memcpy(cachedData_.data(), src_.data(), cachedAmount_);
-    cachedData_[cachedAmount_++]= toProcess;
-    size_t i = 0;
-    do
+    // no more data
+    // just send matched part of the source lexeme
+    if (aEod)
     {
-        pNext_->DoReplacements(cachedData_[i++], false); // send 1 byte after another
-    } while (0 != memcmp(src_.data(), cachedData_.data() + i, --cachedAmount_));
-    // Everything that was needed has already been sent
-    // cachedAmount_ is zero or greater
+        if (matchedAmount_ > 0)
+        {
+            KeepTarget(src_.subspan(0, matchedAmount_));
+            matchedAmount_ = 0;
+        }
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(), true);
+        return;
+    }
+    SendOutput();
 }
 
 
@@ -174,322 +540,1801 @@ static unique_ptr<StreamReplacer> CreateSimpleReplacer(
 ///  O - |-- ...          | - o
 ///      |--SRC N  TRG N  |
 /// 
-class ChoiceReplacer final : public ReplacerWithNext
+/// Aho-Corasick automaton over all source lexemes finds the first match inside of the data
+///   represented by its state. The match is final as soon as its beginning is not represented
+///   by the state anymore.
+///   Small sets of lexemes jump over the data where no lexeme could begin by LexemeStartFilter
+/// 
+template <class Automaton>
+class ChoiceReplacer final : public ReplacerWithOutput
 {
     typedef struct
     {
-        span<const char> src_;
-        span<const char> trg_;
-    }ChoiceReplacerPair;
+        span<const char> src_;
+        span<const char> trg_;
+    }ChoiceReplacerPair;
+
+public:
+    /// <summary>
+    ///   creating ChoiceReplacer from provided pairs
+    /// </summary>
+    /// <param name="sources">source lexemes of the pairs</param>
+    /// <param name="choice">vector os source & target pairs</param>
+    /// <param name="startFilter">use filter to find possible beginnings of source lexemes</param>
+    ChoiceReplacer(const vector<span<const char>>& sources, StreamReplacerChoice& choice, const bool startFilter)
+        : automaton_(sources)
+    {
+        const size_t sz = choice.size();
+        rpairs_.resize(sz);
+        for (size_t i = 0; i < sz; ++i)
+        {
+            auto& vPair = choice[i]; // copy from
+            auto& rpair = rpairs_[i];// copy to
+
+            rpair.src_ = vPair.first->access();
+            rpair.trg_ = vPair.second->access();
+        }
+
+        if (startFilter)
+        {
+            startFilter_.reset(new LexemeStartFilter(sources));
+        }
+    }
+
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+    // not matched part [from_, to_) of the data of a state, then the target of lexeme_ if any
+    struct Step
+    {
+        uint32_t from_;
+        uint32_t to_;
+        uint32_t lexeme_;
+    };
+
+    // the search after the first match of a state: steps for the rest of the data of the state,
+    //   and the state which represents the end of the data
+    struct Resolution
+    {
+        uint32_t state_;
+        size_t stepsBegin_;
+        size_t stepsEnd_;
+    };
+
+protected:
+    /// <summary>
+    ///   Replaces the first match of the state when it becomes final. The rest of the data
+    ///     of the state is searched again once, the steps of the search are replayed next times
+    /// </summary>
+    /// <param name="state">the state with the final match</param>
+    /// <returns>the state which represents the data after the match</returns>
+    uint32_t ReplaceFirstMatch(const uint32_t state) const;
+
+    /// <summary>
+    ///   Searches the data from the position
+    /// </summary>
+    /// <param name="data">data represented by a state</param>
+    /// <param name="position">next character to process</param>
+    /// <param name="state">the state for the data before the position</param>
+    /// <param name="atEnd">the data is the end of the stream: the search is complete</param>
+    /// <param name="steps">not matched data and matches found</param>
+    /// <returns>the state which represents the end of the data</returns>
+    uint32_t Walk(const span<const char> data, size_t position, uint32_t state, const bool atEnd, vector<Step>& steps) const;
+
+    /// <summary>
+    ///   Adds the step; not matched data is merged with the previous step of the same search if possible
+    /// </summary>
+    static void AddStep(vector<Step>& steps, const size_t first, const size_t from, const size_t to, const uint32_t lexeme)
+    {
+        if (steps.size() > first && ChoiceAutomaton::noMatch == steps.back().lexeme_ && steps.back().to_ == from)
+        {
+            steps.back() = {steps.back().from_, static_cast<uint32_t>(to), lexeme};
+            return;
+        }
+        if (from < to || ChoiceAutomaton::noMatch != lexeme)
+        {
+            steps.push_back({static_cast<uint32_t>(from), static_cast<uint32_t>(to), lexeme});
+        }
+    }
+
+    /// <summary>
+    ///   Sends not matched data and targets of the steps
+    /// </summary>
+    /// <param name="data">data represented by a state</param>
+    /// <param name="from">the first step</param>
+    /// <param name="to">the end of the steps</param>
+    void Replay(const span<const char> data, const Step* from, const Step* const to) const
+    {
+        for (; from < to; ++from)
+        {
+            KeepNotReplaced(data.data() + from->from_, data.data() + from->to_);
+            if (ChoiceAutomaton::noMatch != from->lexeme_)
+            {
+                KeepTarget(rpairs_[from->lexeme_].trg_);
+            }
+        }
+    }
+
+    /// <summary>
+    ///   Accumulates the part of the data as not matched one
+    /// </summary>
+    /// <param name="data">data represented by a state</param>
+    /// <param name="pc">next character after the data. Could be nullptr</param>
+    /// <param name="from">the beginning of the part in the data and the character</param>
+    /// <param name="to">the end of the part in the data and the character</param>
+    void KeepNotMatched(const span<const char> data, const char* const pc, const size_t from, const size_t to) const
+    {
+        if (from < data.size())
+        {
+            output_.insert(output_.end(), data.data() + from, data.data() + min(to, data.size()));
+        }
+        if (to > data.size())
+        {
+            output_.push_back(*pc);
+        }
+    }
+
+protected:
+    // our pairs sorted by priority - only one of them could be replaced for concrete pos
+    vector<ChoiceReplacerPair> rpairs_;
+
+    // automaton over source lexemes of rpairs_
+    const Automaton automaton_;
+
+    // finds possible beginnings of source lexemes while the automaton is in the root state
+    unique_ptr<LexemeStartFilter> startFilter_;
+
+    mutable uint32_t state_ = 0; // current state of the automaton
+
+    // resolutions of states with final matches; their steps are in resolutionSteps_
+    mutable unordered_map<uint32_t, Resolution> resolutions_;
+    mutable vector<Step> resolutionSteps_;
+
+    // resolutions are not kept after this amount of steps
+    static constexpr size_t maxResolutionSteps = size_t(1) << 20;
+
+    mutable vector<Step> steps_; // steps which are not kept
+};
+
+
+template <class Automaton>
+uint32_t ChoiceReplacer<Automaton>::ReplaceFirstMatch(const uint32_t state) const
+{
+    const ChoiceAutomaton::State& current = automaton_[state];
+    const span<const char> data = automaton_.StateData(state);
+    const ChoiceReplacerPair& rpair = rpairs_[current.matchLexeme_];
+    KeepNotReplaced(data.data(), data.data() + current.matchOffset_);
+    KeepTarget(rpair.trg_);
+
+    if (const auto it = resolutions_.find(state); it != resolutions_.cend())
+    {
+        const Resolution& resolution = it->second;
+        Replay(data, resolutionSteps_.data() + resolution.stepsBegin_, resolutionSteps_.data() + resolution.stepsEnd_);
+        return resolution.state_;
+    }
+
+    // the data after the match is searched from the root
+    const size_t after = current.matchOffset_ + rpair.src_.size();
+    if (resolutionSteps_.size() < maxResolutionSteps)
+    {
+        const size_t stepsBegin = resolutionSteps_.size();
+        const uint32_t next = Walk(data, after, 0, false, resolutionSteps_);
+        resolutions_.emplace(state, Resolution{next, stepsBegin, resolutionSteps_.size()});
+        Replay(data, resolutionSteps_.data() + stepsBegin, resolutionSteps_.data() + resolutionSteps_.size());
+        return next;
+    }
+
+    steps_.clear();
+    const uint32_t next = Walk(data, after, 0, false, steps_);
+    Replay(data, steps_.data(), steps_.data() + steps_.size());
+    return next;
+}
+
+
+template <class Automaton>
+uint32_t ChoiceReplacer<Automaton>::Walk(const span<const char> data, size_t position, uint32_t state,
+    const bool atEnd, vector<Step>& steps) const
+{
+    const size_t first = steps.size(); // steps before are not merged
+    for (;;)
+    {
+        const ChoiceAutomaton::State& current = automaton_[state];
+        const size_t regionBegin = position - current.depth_; // where the data of the state begins
+        uint32_t next = 0;
+        size_t leaving = current.depth_; // the end of the data: all data leaves the state
+        if (position < data.size())
+        {
+            next = automaton_.Transition(state, data[position]);
+            leaving = current.depth_ + 1 - automaton_[next].depth_;
+        }
+        else if (!atEnd || 0 == state)
+        {
+            return state;
+        }
+
+        if (ChoiceAutomaton::noMatch != current.matchLexeme_ && current.matchOffset_ < leaving)
+        {// the match is final - do replacement, and search again after it
+            AddStep(steps, first, regionBegin, regionBegin + current.matchOffset_, current.matchLexeme_);
+            position = regionBegin + current.matchOffset_ + rpairs_[current.matchLexeme_].src_.size();
+            state = 0;
+            continue;
+        }
+
+        AddStep(steps, first, regionBegin, regionBegin + leaving, ChoiceAutomaton::noMatch);
+        state = next;
+        ++position;
+    }
+}
+
+
+template <class Automaton>
+void ChoiceReplacer<Automaton>::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    const char* const pEnd = toProcess.data() + toProcess.size();
+    // the filter checks few bytes from a position, so it could be used before this position only
+    const char* const filterEnd = (startFilter_ && toProcess.size() >= startFilter_->Width()) ?
+        pEnd - (startFilter_->Width() - 1) : toProcess.data();
+    for (const char* pc = toProcess.data(); pc < pEnd; ++pc)
+    {
+        if (0 == state_ && pc < filterEnd)
+        {
+            // fast track: data where no source lexeme could begin is not matched
+            const char* const pStart = startFilter_->Find(pc, filterEnd);
+            KeepNotReplaced(pc, pStart);
+            pc = pStart;
+            if (pc == pEnd)
+            {
+                break;
+            }
+        }
+
+        for (;;)
+        {
+            const ChoiceAutomaton::State& current = automaton_[state_];
+            const uint32_t next = automaton_.Transition(state_, *pc);
+
+            // this amount of data is not represented by the next state
+            const size_t leaving = current.depth_ + 1 - automaton_[next].depth_;
+            if (ChoiceAutomaton::noMatch == current.matchLexeme_ || current.matchOffset_ >= leaving) [[likely]]
+            {// no match became final
+                KeepNotMatched(automaton_.StateData(state_), pc, 0, leaving);
+                state_ = next;
+                break;
+            }
+
+            // the character is processed again after the match
+            state_ = ReplaceFirstMatch(state_);
+        }
+
+        if (output_.size() >= SZBUFF_FC) [[unlikely]]
+        {
+            SendOutput();
+        }
+    }
+
+    if (aEod) [[unlikely]]
+    {
+        // all matches inside of the data of the state are final
+        const span<const char> data = automaton_.StateData(state_);
+        steps_.clear();
+        Walk(data, data.size(), state_, true, steps_);
+        Replay(data, steps_.data(), steps_.data() + steps_.size());
+        state_ = 0;
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(), true);
+        return;
+    }
+    SendOutput();
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   Choice among long lexemes without automaton: source lexemes are compared at the possible
+///     beginnings in the order of priority. The first of them which either matches or could match
+///     in the next blocks of data decides the position.
+///   The data which could match is always the beginning of a source lexeme, so like in UsualReplacer
+///     it is never cached: the lexeme and the length are kept. Memory of the replacer does not grow
+///     with the length of source lexemes
+/// </summary>
+class ScanChoiceReplacer final : public ReplacerWithOutput
+{
+    typedef struct
+    {
+        span<const char> src_;
+        span<const char> trg_;
+    }ChoiceReplacerPair;
+
+    // the position is decided by this pair; partial_ if its source could match in the next blocks
+    struct Decision
+    {
+        uint32_t pair_;
+        bool partial_;
+    };
+
+    static constexpr uint32_t noPair = numeric_limits<uint32_t>::max();
+
+public:
+    /// <summary>
+    ///   creating ScanChoiceReplacer from provided pairs
+    /// </summary>
+    /// <param name="sources">source lexemes of the pairs</param>
+    /// <param name="choice">vector os source & target pairs</param>
+    /// <param name="startFilter">use filter to find possible beginnings of source lexemes</param>
+    ScanChoiceReplacer(const vector<span<const char>>& sources, StreamReplacerChoice& choice, const bool startFilter)
+    {
+        const size_t sz = choice.size();
+        rpairs_.resize(sz);
+        for (size_t i = 0; i < sz; ++i)
+        {
+            rpairs_[i].src_ = choice[i].first->access();
+            rpairs_[i].trg_ = choice[i].second->access();
+        }
+
+        // pairs are grouped by the first byte of the source; the order of priority is kept in the group
+        for (const auto& rpair : rpairs_)
+        {
+            ++firstOffsets_[static_cast<unsigned char>(rpair.src_.front()) + 1];
+        }
+        for (size_t c = 1; c < size(firstOffsets_); ++c)
+        {
+            firstOffsets_[c] += firstOffsets_[c - 1];
+        }
+        byFirst_.resize(sz);
+        uint32_t filled[256] = {};
+        for (uint32_t i = 0; i < sz; ++i)
+        {
+            const unsigned char first = static_cast<unsigned char>(rpairs_[i].src_.front());
+            byFirst_[firstOffsets_[first] + filled[first]++] = i;
+        }
+
+        if (startFilter)
+        {
+            startFilter_.reset(new LexemeStartFilter(sources));
+        }
+    }
+
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    /// <summary>
+    ///   looks for the position where one of source lexemes could begin
+    /// </summary>
+    /// <param name="pc">search from this position</param>
+    /// <param name="pEnd">the end of the block of data</param>
+    /// <returns>the position or pEnd if no source lexeme begins in the block</returns>
+    const char* FindBeginning(const char* pc, const char* const pEnd) const
+    {
+        if (startFilter_ && static_cast<size_t>(pEnd - pc) >= startFilter_->Width())
+        {
+            // the filter checks few bytes from a position, so it could be used before this position only
+            const char* const filterEnd = pEnd - (startFilter_->Width() - 1);
+            if (pc = startFilter_->Find(pc, filterEnd); pc < filterEnd)
+            {
+                return pc;
+            }
+        }
+        while (pc < pEnd && firstOffsets_[static_cast<unsigned char>(*pc)] == firstOffsets_[static_cast<unsigned char>(*pc) + 1])
+        {
+            ++pc;
+        }
+        return pc;
+    }
+
+    /// <summary>
+    ///   compares source lexemes with the data at the position
+    /// </summary>
+    /// <param name="first">the data from the position; not empty</param>
+    /// <param name="second">the data after the first part</param>
+    /// <param name="atEnd">the data is the end of the stream: nothing could match in the next blocks</param>
+    /// <param name="skip">amount of source lexemes beginning with the same byte known as not matching</param>
+    /// <returns>the pair which decides the position; noPair if no source lexeme begins at the position</returns>
+    Decision Decide(const span<const char> first, const span<const char> second, const bool atEnd, const size_t skip = 0) const;
+
+    /// <summary>
+    ///   processes the data kept from the previous blocks followed by the block
+    /// </summary>
+    /// <param name="toProcess">the block of data</param>
+    /// <param name="aEod">the block is the end of the stream</param>
+    /// <returns>the position in the block to continue processing from</returns>
+    const char* ProcessKept(const span<const char> toProcess, const bool aEod) const;
+
+    /// <summary>
+    ///   keeps the data which could be the beginning of the source
+    /// </summary>
+    /// <param name="pair">the pair of the source</param>
+    /// <param name="amount">the length of the data</param>
+    void Keep(const uint32_t pair, const size_t amount) const
+    {
+        const auto group = byFirst_.begin() + firstOffsets_[static_cast<unsigned char>(rpairs_[pair].src_.front())];
+        keptPair_ = pair;
+        keptAmount_ = amount;
+        keptSkip_ = static_cast<size_t>(find(group, byFirst_.end(), pair) - group);
+    }
+
+protected:
+    // our pairs sorted by priority - only one of them could be replaced for concrete pos
+    vector<ChoiceReplacerPair> rpairs_;
+
+    // indexes of pairs sorted by the first byte of the source and then by priority;
+    //   the pairs beginning with byte c are [firstOffsets_[c], firstOffsets_[c + 1])
+    vector<uint32_t> byFirst_;
+    uint32_t firstOffsets_[257] = {};
+
+    // finds possible beginnings of source lexemes
+    unique_ptr<LexemeStartFilter> startFilter_;
+
+    // the data kept from the previous blocks is this beginning of the source of keptPair_
+    mutable uint32_t keptPair_ = noPair;
+    mutable size_t keptAmount_ = 0;
+
+    // the pairs of keptPair_'s group before it do not match the kept data
+    mutable size_t keptSkip_ = 0;
+};
+
+
+ScanChoiceReplacer::Decision ScanChoiceReplacer::Decide(const span<const char> first, const span<const char> second,
+    const bool atEnd, const size_t skip) const
+{
+    const unsigned char c = static_cast<unsigned char>(first.front());
+    for (size_t i = firstOffsets_[c] + skip; i < firstOffsets_[c + 1]; ++i)
+    {
+        const span<const char> src = rpairs_[byFirst_[i]].src_;
+        const size_t inFirst = min(src.size(), first.size());
+
+        // the kept data is the beginning of the source already
+        if (src.data() != first.data() && 0 != memcmp(src.data(), first.data(), inFirst))
+        {
+            continue;
+        }
+        const size_t inSecond = min(src.size() - inFirst, second.size());
+        if (inSecond > 0 && 0 != memcmp(src.data() + inFirst, second.data(), inSecond))
+        {
+            continue;
+        }
+        if (inFirst + inSecond == src.size())
+        {
+            return {byFirst_[i], false};
+        }
+        if (!atEnd)
+        {
+            return {byFirst_[i], true};
+        }
+    }
+    return {noPair, false};
+}
+
+
+const char* ScanChoiceReplacer::ProcessKept(const span<const char> toProcess, const bool aEod) const
+{
+    const span<const char> kept = rpairs_[keptPair_].src_.first(keptAmount_);
+    size_t skip = keptSkip_;
+    keptPair_ = noPair;
+    keptAmount_ = 0;
+    keptSkip_ = 0;
+
+    size_t pos = 0;
+    size_t runFrom = 0; // not matched data to be sent further as one block
+    while (pos < kept.size())
+    {
+        const Decision decision = Decide(kept.subspan(pos), toProcess, aEod, skip);
+        skip = 0;
+        if (noPair == decision.pair_)
+        {
+            ++pos;
+            continue;
+        }
+
+        KeepTarget(kept.subspan(runFrom, pos - runFrom));
+        if (decision.partial_)
+        {
+            // the rest of the kept data and the block are the beginning of the source
+            Keep(decision.pair_, kept.size() - pos + toProcess.size());
+            return toProcess.data() + toProcess.size();
+        }
+        KeepTarget(rpairs_[decision.pair_].trg_);
+        runFrom = pos = pos + rpairs_[decision.pair_].src_.size();
+    }
+
+    if (runFrom < kept.size())
+    {
+        KeepTarget(kept.subspan(runFrom));
+    }
+    return toProcess.data() + (pos - kept.size());
+}
+
+
+void ScanChoiceReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    const char* const pEnd = toProcess.data() + toProcess.size();
+    const char* pc = (noPair != keptPair_) ? ProcessKept(toProcess, aEod) : toProcess.data();
+    while (pc < pEnd)
+    {
+        // fast track: data where no source lexeme could begin is not matched
+        const char* const pStart = FindBeginning(pc, pEnd);
+        KeepNotReplaced(pc, pStart);
+        if (pc = pStart; pc == pEnd)
+        {
+            break;
+        }
+
+        const Decision decision = Decide(span<const char>(pc, pEnd), span<const char>(), aEod);
+        if (noPair == decision.pair_)
+        {
+            KeepNotReplaced(pc, pc + 1);
+            ++pc;
+            continue;
+        }
+        if (decision.partial_)
+        {
+            // the rest of the block could be the beginning of the source
+            Keep(decision.pair_, static_cast<size_t>(pEnd - pc));
+            break;
+        }
+        KeepTarget(rpairs_[decision.pair_].trg_);
+        pc += rpairs_[decision.pair_].src_.size();
+    }
+
+    if (aEod) [[unlikely]]
+    {
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(), true);
+        return;
+    }
+    SendOutput();
+}
+
+
+/// <summary>
+///   creates replacer for choose specific lexeme among lexemes of different length
+/// </summary>
+/// <param name="choice">set of pairs of src & trg lexemes - one of which
+///   can be processed. The one that was found first.</param>
+/// <returns>Replacer for building replacement chain</returns>
+static unique_ptr<StreamReplacer> CreateChoiceReplacer(StreamReplacerChoice& choice)
+{
+    // the filter of lexeme beginnings passes almost everything for more lexemes
+    constexpr size_t maxLexemesForStartFilter = 64;
+
+    // bigger transitions table does not fit into caches; double-array trie is used instead
+    constexpr size_t maxTransitionsTableSize = 64 * 1024 * 1024;
+
+    // every byte of source lexemes is a state of the automaton: long lexemes are compared
+    //   with the data instead. Comparisons of more lexemes at each position are too slow
+    constexpr size_t maxAutomatonSourceBytes = 1024 * 1024;
+    constexpr size_t maxLexemesToCompare = 1024;
+
+    vector<span<const char>> sources;
+    size_t sourceBytes = 0;
+    for (const AbstractLexemesPair& alpair : choice)
+    {
+        sources.push_back(alpair.first->access());
+        sourceBytes += sources.back().size();
+    }
+
+    const bool startFilter = choice.size() <= maxLexemesForStartFilter;
+    if (sourceBytes > maxAutomatonSourceBytes && choice.size() <= maxLexemesToCompare)
+    {
+        return unique_ptr<StreamReplacer>(new ScanChoiceReplacer(sources, choice, startFilter));
+    }
+    if (TableChoiceAutomaton::EstimateSize(sources) > maxTransitionsTableSize)
+    {
+        return unique_ptr<StreamReplacer>(new ChoiceReplacer<DoubleArrayChoiceAutomaton>(sources, choice, startFilter));
+    }
+    return unique_ptr<StreamReplacer>(new ChoiceReplacer<TableChoiceAutomaton>(sources, choice, startFilter));
+}
+
+namespace
+{
+    static std::string_view warningDuplicatePattern("Warning: Duplicate pattern to replace found. Second lexeme will be ignored.");
+};
+
+
+//--------------------------------------------------
+/// <summary>
+///   polynomial hash of windows of the data; it is rolled by one byte
+/// </summary>
+struct PolynomialHash
+{
+    static constexpr uint64_t hashBase = 0x100000001b3; // multiplier of the polynomial hash
+
+    /// <summary>
+    ///   hash of the window
+    /// </summary>
+    /// <param name="pc">the beginning of the window</param>
+    /// <param name="sz">size of the window</param>
+    static uint64_t Hash(const char* const pc, const size_t sz) noexcept
+    {
+        uint64_t hash = 0;
+        for (size_t i = 0; i < sz; ++i)
+        {
+            hash = hash * hashBase + static_cast<unsigned char>(pc[i]);
+        }
+        return hash;
+    }
+
+    /// <summary>
+    ///   hashBase in power of (sz - 1): weight of the first byte of the window
+    /// </summary>
+    /// <param name="sz">size of the window</param>
+    static uint64_t HighPower(const size_t sz) noexcept
+    {
+        uint64_t highPower = 1;
+        for (size_t i = 1; i < sz; ++i)
+        {
+            highPower *= hashBase;
+        }
+        return highPower;
+    }
+
+    /// <summary>
+    ///   hash of the window moved forward by one byte
+    /// </summary>
+    /// <param name="hash">hash of the window</param>
+    /// <param name="out">the first byte of the window</param>
+    /// <param name="in">the byte after the window</param>
+    /// <param name="highPower">HighPower of the size of the window</param>
+    static uint64_t Roll(const uint64_t hash, const char out, const char in, const uint64_t highPower) noexcept
+    {
+        return (hash - static_cast<unsigned char>(out) * highPower) * hashBase + static_cast<unsigned char>(in);
+    }
+};
+
+
+//--------------------------------------------------
+/// <summary>
+///   open addressing table of source lexemes by keys. Bitset of mixed keys rejects most
+///     of absent keys before the table is probed
+/// </summary>
+template <class Key>
+class LexemesTable final
+{
+    struct Slot
+    {
+        Key key_ = 0;
+        uint32_t pair_ = noPair; // index of the pair; noPair for empty slot
+    };
+
+    static constexpr uint64_t hashMix = 0x9e3779b97f4a7c15; // spreads the key into high bits
+
+    static constexpr size_t minBloomBits = 16; // bitset of 64K bits fits in L1 cache
+
+public:
+    static constexpr uint32_t noPair = numeric_limits<uint32_t>::max();
+
+    /// <param name="amount">amount of lexemes to keep</param>
+    LexemesTable(const size_t amount)
+    {
+        size_t slotsBits = 4;
+        while ((size_t(1) << slotsBits) < 2 * amount)
+        {
+            ++slotsBits;
+        }
+        slotsShift_ = 64 - slotsBits;
+        slots_.resize(size_t(1) << slotsBits);
+
+        // few bits of the bitset are set for each source lexeme
+        size_t bloomBits = minBloomBits;
+        while ((size_t(1) << bloomBits) < 16 * amount)
+        {
+            ++bloomBits;
+        }
+        bloomShift_ = 64 - bloomBits;
+        bloom_.resize((size_t(1) << bloomBits) / 64);
+    }
+
+    /// <summary>
+    ///   spreads the key into high bits: the bit and the first slot are taken from them
+    /// </summary>
+    static uint64_t Mixed(const uint64_t key) noexcept
+    {
+        return key * hashMix;
+    }
+
+    /// <summary>
+    ///   adds the lexeme which is not in the table
+    /// </summary>
+    /// <param name="mixed">mixed key of the lexeme</param>
+    /// <param name="key">key of the lexeme</param>
+    /// <param name="pair">index of the pair of the lexeme</param>
+    void Insert(const uint64_t mixed, const Key key, const uint32_t pair)
+    {
+        size_t index = mixed >> slotsShift_;
+        while (noPair != slots_[index].pair_)
+        {
+            index = (index + 1) & (slots_.size() - 1);
+        }
+        slots_[index] = {key, pair};
+        const size_t bit = mixed >> bloomShift_;
+        bloom_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    /// <summary>
+    ///   looks for the lexeme
+    /// </summary>
+    /// <param name="mixed">mixed key of the data</param>
+    /// <param name="key">key of the data</param>
+    /// <param name="equal">checks if the data is the lexeme of the pair with the same key</param>
+    /// <returns>index of the pair; noPair if there is no such source lexeme</returns>
+    template <class Equal>
+    uint32_t Find(const uint64_t mixed, const Key key, const Equal& equal) const noexcept
+    {
+        if (const size_t bit = mixed >> bloomShift_; 0 == (bloom_[bit / 64] & (uint64_t(1) << (bit % 64))))
+        {
+            return noPair;
+        }
+        for (size_t index = mixed >> slotsShift_; noPair != slots_[index].pair_; index = (index + 1) & (slots_.size() - 1))
+        {
+            if (const Slot& slot = slots_[index]; slot.key_ == key && equal(slot.pair_))
+            {
+                return slot.pair_;
+            }
+        }
+        return noPair;
+    }
+
+protected:
+    vector<Slot> slots_; // the first slot is taken from high bits of mixed key
+    size_t slotsShift_ = 0;
+
+    vector<uint64_t> bloom_; // bits of mixed keys of source lexemes
+    size_t bloomShift_ = 0; // the bit is taken from high bits of mixed key
+};
+
+//--------------------------------------------------
+/// <summary>
+///   replaces for lexemes of the same length
+///     Rabin-Karp: hash of the window is rolled by one byte. Bitset of hashes skips most
+///     of not matching windows, the rest are looked for in the open addressing table
+/// </summary>
+class UniformLexemeReplacer final : public StitchedReplacer
+{
+    typedef LexemesTable<uint64_t> Table;
+
+public:
+    UniformLexemeReplacer(StreamReplacerChoice& choice, const size_t sz)
+        : StitchedReplacer(sz)
+        , sz_(sz)
+        , highPower_(PolynomialHash::HighPower(sz))
+        , table_(choice.size())
+    {
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const span<const char>& src = alpair.first->access();
+            const uint64_t hash = PolynomialHash::Hash(src.data(), sz_);
+            if (Table::noPair != FindPair(hash, src.data()))
+            {
+                cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
+            }
+            table_.Insert(Table::Mixed(hash), hash, static_cast<uint32_t>(rpairs_.size()));
+            rpairs_.push_back({src, alpair.second->access()});
+        }
+    }
+
+protected:
+    /// <summary>
+    ///   looks for the pair with source lexeme in the window
+    /// </summary>
+    /// <param name="hash">hash of the window</param>
+    /// <param name="pc">the beginning of the window</param>
+    /// <returns>index of the pair; noPair if there is no such source lexeme</returns>
+    uint32_t FindPair(const uint64_t hash, const char* const pc) const noexcept
+    {
+        return table_.Find(Table::Mixed(hash), hash,
+            [this, pc](const uint32_t pair) { return 0 == memcmp(rpairs_[pair].first.data(), pc, sz_); });
+    }
+
+    const char* Process(const char* pc, const char* const pLimit, const char* const pEnd) const override;
+
+protected:
+    const size_t sz_; // size of all source lexemes
+    const uint64_t highPower_; // weight of the first byte of the window
+
+    // pairs of sources and targets in order of priority
+    vector<pair<span<const char>, span<const char>>> rpairs_;
+
+    Table table_; // source lexemes by hashes
+};
+
+
+const char* UniformLexemeReplacer::Process(const char* pc, const char* const pLimit, const char* const pEnd) const
+{
+    const char* runFrom = pc; // not matched data to be sent further as one block
+    while (pc < pLimit && pc + sz_ <= pEnd)
+    {
+        uint64_t hash = PolynomialHash::Hash(pc, sz_);
+        uint32_t found = FindPair(hash, pc);
+        while (Table::noPair == found)
+        {
+            if (pc + 1 >= pLimit || pc + sz_ >= pEnd)
+            {
+                ++pc;
+                break;
+            }
+            hash = PolynomialHash::Roll(hash, pc[0], pc[sz_], highPower_);
+            found = FindPair(hash, ++pc);
+        }
+        if (Table::noPair == found)
+        {
+            break;
+        }
+
+        KeepNotReplaced(runFrom, pc);
+        KeepTarget(rpairs_[found].second);
+        pc += sz_;
+        runFrom = pc;
+    }
+
+    KeepNotReplaced(runFrom, pc);
+    return pc;
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   replaces for lexemes of few different lengths
+///     Rabin-Karp for each length: hashes of windows of all lengths are rolled by one byte.
+///     Sources of all lengths share one bitset of hashes and one open addressing table.
+///     Among lexemes which begin at the same position the pair found first in the choice wins
+/// </summary>
+class LengthBucketReplacer final : public StitchedReplacer
+{
+    typedef LexemesTable<uint64_t> Table;
+
+    // sources of the same length
+    struct Bucket
+    {
+        size_t sz_ = 0; // size of source lexemes
+        uint64_t highPower_ = 1; // weight of the first byte of the window
+    };
+
+public:
+    // more lengths make every position too expensive to check
+    static constexpr size_t maxBuckets = 4;
+
+    LengthBucketReplacer(StreamReplacerChoice& choice)
+        : StitchedReplacer(LongestSource(choice))
+        , table_(choice.size())
+    {
+        for (const AbstractLexemesPair& alpair : choice)
+        {
+            const size_t sz = alpair.first->access().size();
+            const auto it = lower_bound(buckets_, buckets_ + bucketsCount_, sz,
+                [](const Bucket& bucket, const size_t sz) { return bucket.sz_ < sz; });
+            if (it != buckets_ + bucketsCount_ && it->sz_ == sz)
+            {
+                continue;
+            }
+            if (bucketsCount_ == maxBuckets)
+            {
+                throw logic_error("Too many lengths of lexemes for replacer of few lengths. Communicate with maintainer");
+            }
+            move_backward(it, buckets_ + bucketsCount_, buckets_ + bucketsCount_ + 1);
+            *it = {sz, PolynomialHash::HighPower(sz)};
+            ++bucketsCount_;
+        }
+
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const span<const char>& src = alpair.first->access();
+            const uint64_t hash = PolynomialHash::Hash(src.data(), src.size());
+            if (Table::noPair != FindPair(hash, src.data(), src.size()))
+            {
+                cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
+            }
+            table_.Insert(Mixed(hash, src.size()), hash, static_cast<uint32_t>(rpairs_.size()));
+            rpairs_.push_back({src, alpair.second->access()});
+        }
+    }
+
+protected:
+    /// <summary>
+    ///   hash of the window in the shared table; windows of different sizes are mixed differently
+    /// </summary>
+    static uint64_t Mixed(const uint64_t hash, const size_t sz) noexcept
+    {
+        return Table::Mixed(hash + sz);
+    }
+
+    /// <summary>
+    ///   looks for the pair with source lexeme in the window
+    /// </summary>
+    /// <param name="hash">hash of the window</param>
+    /// <param name="pc">the beginning of the window</param>
+    /// <param name="sz">size of the window</param>
+    /// <returns>index of the pair; noPair if there is no such source lexeme</returns>
+    uint32_t FindPair(const uint64_t hash, const char* const pc, const size_t sz) const noexcept
+    {
+        return table_.Find(Mixed(hash, sz), hash, [this, pc, sz](const uint32_t pair)
+            {
+                const span<const char>& src = rpairs_[pair].first;
+                return src.size() == sz && 0 == memcmp(src.data(), pc, sz);
+            });
+    }
+
+    /// <summary>
+    ///   looks for the pair found first in the choice among lexemes at the position
+    /// </summary>
+    /// <param name="hashes">hashes of windows at the position for each bucket</param>
+    /// <param name="pc">the position</param>
+    /// <param name="buckets">amount of buckets to check: windows of the rest are out of the data</param>
+    /// <returns>index of the pair; noPair if no source lexeme begins at the position</returns>
+    uint32_t FindFirstPair(const uint64_t* const hashes, const char* const pc, const size_t buckets) const noexcept
+    {
+        uint32_t found = Table::noPair;
+        for (size_t i = 0; i < buckets; ++i)
+        {
+            found = min(found, FindPair(hashes[i], pc, buckets_[i].sz_));
+        }
+        return found;
+    }
+
+    /// <summary>
+    ///   replaces lexemes which begin before pLimit and where windows of all lengths end not
+    ///     after pEnd. Keeps all data before the returned position for the output
+    /// </summary>
+    /// <param name="pc">the beginning of the data</param>
+    /// <param name="pLimit">lexemes begin before this position</param>
+    /// <param name="pEnd">the end of the data</param>
+    /// <returns>position of the first not processed byte</returns>
+    const char* Process(const char* pc, const char* const pLimit, const char* const pEnd) const override;
+
+    /// <summary>
+    ///   replaces lexemes in the end of the stream, where windows of longer lexemes are out of the data
+    /// </summary>
+    /// <param name="pc">the beginning of the data</param>
+    /// <param name="pEnd">the end of the stream</param>
+    void ProcessLast(const char* pc, const char* const pEnd) const override;
+
+protected:
+    Bucket buckets_[maxBuckets]; // buckets in order of size of source lexemes
+    size_t bucketsCount_ = 0;
+
+    // pairs of sources and targets in order of priority
+    vector<pair<span<const char>, span<const char>>> rpairs_;
+
+    Table table_; // source lexemes of all lengths by hashes
+};
+
+
+const char* LengthBucketReplacer::Process(const char* pc, const char* const pLimit, const char* const pEnd) const
+{
+    const char* runFrom = pc; // not replaced data
+    uint64_t hashes[maxBuckets];
+    bool hashed = false; // hashes are of windows at the position
+    while (pc < pLimit && pc + maxSize_ <= pEnd)
+    {
+        if (!hashed)
+        {
+            for (size_t i = 0; i < bucketsCount_; ++i)
+            {
+                hashes[i] = PolynomialHash::Hash(pc, buckets_[i].sz_);
+            }
+            hashed = true;
+        }
+
+        if (const uint32_t found = FindFirstPair(hashes, pc, bucketsCount_); Table::noPair != found)
+        {
+            KeepNotReplaced(runFrom, pc);
+            KeepTarget(rpairs_[found].second);
+            pc += rpairs_[found].first.size();
+            runFrom = pc;
+            hashed = false;
+            continue;
+        }
+
+        if (++pc + maxSize_ <= pEnd)
+        {
+            for (size_t i = 0; i < bucketsCount_; ++i)
+            {
+                hashes[i] = PolynomialHash::Roll(hashes[i], pc[-1], pc[buckets_[i].sz_ - 1], buckets_[i].highPower_);
+            }
+        }
+    }
+
+    KeepNotReplaced(runFrom, pc);
+    return pc;
+}
+
+
+void LengthBucketReplacer::ProcessLast(const char* pc, const char* const pEnd) const
+{
+    uint64_t hashes[maxBuckets];
+    while (pc < pEnd)
+    {
+        size_t buckets = 0; // windows of these buckets are inside of the data
+        for (; buckets < bucketsCount_ && pc + buckets_[buckets].sz_ <= pEnd; ++buckets)
+        {
+            hashes[buckets] = PolynomialHash::Hash(pc, buckets_[buckets].sz_);
+        }
+
+        if (const uint32_t found = FindFirstPair(hashes, pc, buckets); Table::noPair != found)
+        {
+            KeepTarget(rpairs_[found].second);
+            pc += rpairs_[found].first.size();
+            continue;
+        }
+        output_.push_back(*pc++);
+    }
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   replaces for many long lexemes. Wu-Manber: the window of the shortest source lexeme
+///     is moved by the shift of its last block of B bytes; the shift is zero only if the block
+///     ends the window of some source lexeme. Then source lexemes with this block are checked
+///     in order of priority, the first bytes of them are compared before the whole lexeme
+/// </summary>
+template <size_t B>
+class WuManberReplacer final : public StitchedReplacer
+{
+    // source lexeme to check when the window ends with its block
+    struct Candidate
+    {
+        uint32_t prefix_; // the first bytes of the source lexeme
+        uint32_t pair_; // index in rpairs_
+    };
+
+    static constexpr size_t shiftsBits = 8 * B > 18 ? 18 : 8 * B; // size of the table of shifts
+    static constexpr size_t maxWindow = numeric_limits<uint16_t>::max(); // shifts fit in uint16_t
+
+public:
+    WuManberReplacer(StreamReplacerChoice& choice)
+        : StitchedReplacer(LongestSource(choice))
+    {
+        set<string_view> sources;
+        size_t minSize = numeric_limits<size_t>::max();
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const span<const char>& src = alpair.first->access();
+            if (!sources.emplace(src.data(), src.size()).second)
+            {
+                cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
+            }
+            rpairs_.push_back({src, alpair.second->access()});
+            minSize = min(minSize, src.size());
+        }
+        window_ = min(minSize, maxWindow);
+
+        // shifts of blocks inside of windows of source lexemes
+        fill(begin(shifts_), end(shifts_), static_cast<uint16_t>(window_ - B + 1));
+        vector<uint32_t> counts(size_t(1) << shiftsBits);
+        for (const auto& rpair : rpairs_)
+        {
+            const span<const char>& src = rpair.first;
+            for (size_t i = B; i <= window_; ++i)
+            {
+                uint16_t& shift = shifts_[BlockIndex(src.data() + i - B)];
+                shift = min(shift, static_cast<uint16_t>(window_ - i));
+            }
+            ++counts[BlockIndex(src.data() + window_ - B)];
+        }
+
+        // candidates are grouped by the last block of the window, in order of priority
+        candidatesFrom_.resize(counts.size() + 1);
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            candidatesFrom_[i + 1] = candidatesFrom_[i] + counts[i];
+        }
+        candidates_.resize(rpairs_.size());
+        for (size_t i = 0; i < rpairs_.size(); ++i)
+        {
+            const span<const char>& src = rpairs_[i].first;
+            const size_t index = BlockIndex(src.data() + window_ - B);
+            candidates_[candidatesFrom_[index + 1] - counts[index]--] = {Prefix(src.data()), static_cast<uint32_t>(i)};
+        }
+    }
+
+protected:
+    /// <summary>
+    ///   index of the block in the table of shifts
+    /// </summary>
+    /// <param name="pc">the beginning of the block of B bytes</param>
+    static size_t BlockIndex(const char* const pc) noexcept
+    {
+        uint32_t block = 0;
+        for (size_t i = 0; i < B; ++i)
+        {
+            block |= static_cast<uint32_t>(static_cast<unsigned char>(pc[i])) << (8 * i);
+        }
+        if constexpr (8 * B == shiftsBits)
+        {
+            return block;
+        }
+        else
+        {
+            return (block * 0x9e3779b1u) >> (32 - shiftsBits);
+        }
+    }
+
+    /// <summary>
+    ///   the first bytes of the data to compare before the whole lexeme
+    /// </summary>
+    /// <param name="pc">the beginning of the data of at least the window size</param>
+    uint32_t Prefix(const char* const pc) const noexcept
+    {
+        uint32_t prefix = 0;
+        memcpy(&prefix, pc, min(sizeof(prefix), window_));
+        return prefix;
+    }
+
+    /// <summary>
+    ///   replaces lexemes which begin before pLimit. Keeps all data before the returned position for the output
+    /// </summary>
+    /// <param name="pc">the beginning of the data</param>
+    /// <param name="pLimit">lexemes begin before this position</param>
+    /// <param name="pEnd">the end of the data</param>
+    /// <param name="atEnd">the data is the end of the stream: lexemes are looked for up to the end</param>
+    /// <returns>position of the first not processed byte</returns>
+    const char* Search(const char* pc, const char* const pLimit, const char* const pEnd, const bool atEnd) const;
+
+    const char* Process(const char* pc, const char* const pLimit, const char* const pEnd) const override
+    {
+        return Search(pc, pLimit, pEnd, false);
+    }
+
+    void ProcessLast(const char* pc, const char* const pEnd) const override
+    {
+        Search(pc, pEnd, pEnd, true);
+    }
+
+protected:
+    // pairs of sources and targets in order of priority
+    vector<pair<span<const char>, span<const char>>> rpairs_;
+
+    size_t window_ = 0; // the shortest source lexeme, limited by maxWindow
+
+    uint16_t shifts_[size_t(1) << shiftsBits]; // shift of the window by its last block
+    vector<uint32_t> candidatesFrom_; // candidates for the last block i are from candidatesFrom_[i] to candidatesFrom_[i + 1]
+    vector<Candidate> candidates_;
+};
+
+
+template <size_t B>
+const char* WuManberReplacer<B>::Search(const char* pc, const char* const pLimit, const char* const pEnd, const bool atEnd) const
+{
+    const char* runFrom = pc; // not replaced data
+    const size_t reach = atEnd ? window_ : maxSize_; // data needed after the position to decide about the lexeme
+    while (pc < pLimit && static_cast<size_t>(pEnd - pc) >= reach)
+    {
+        const size_t index = BlockIndex(pc + window_ - B);
+        if (const size_t shift = shifts_[index]; shift > 0) [[likely]]
+        {
+            pc += shift;
+            continue;
+        }
+
+        const uint32_t prefix = Prefix(pc);
+        uint32_t found = numeric_limits<uint32_t>::max();
+        for (uint32_t i = candidatesFrom_[index]; i < candidatesFrom_[index + 1]; ++i)
+        {
+            if (const Candidate& candidate = candidates_[i]; candidate.prefix_ == prefix)
+            {
+                if (const span<const char>& src = rpairs_[candidate.pair_].first;
+                    src.size() <= static_cast<size_t>(pEnd - pc) && 0 == memcmp(src.data(), pc, src.size()))
+                {
+                    found = candidate.pair_;
+                    break;
+                }
+            }
+        }
+        if (numeric_limits<uint32_t>::max() == found)
+        {
+            ++pc;
+            continue;
+        }
+
+        KeepNotReplaced(runFrom, pc);
+        KeepTarget(rpairs_[found].second);
+        pc += rpairs_[found].first.size();
+        runFrom = pc;
+    }
+
+    if (atEnd)
+    {// no lexeme fits in the rest of the data
+        pc = pEnd;
+    }
+    KeepNotReplaced(runFrom, pc);
+    return pc;
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   replaces for lexemes of the same length
+/// </summary>
+class LexemeOf1Replacer final : public ReplacerWithOutput
+{
+public:
+    LexemeOf1Replacer(StreamReplacerChoice& choice)
+    {
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const size_t index = static_cast<const size_t>(*(reinterpret_cast<const unsigned char*>(alpair.first->access().data())));
+            if (replaces_[index].present_)
+            {
+                cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+            }
+            else
+            {
+                replaces_[index].present_ = true;
+                replaces_[index].trg_ = alpair.second->access();
+            }
+        }
+    }
+
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    struct
+    {
+        bool present_ = false; // if this char is present
+        span<const char> trg_;
+    } replaces_[256];
+};
+
+
+void LexemeOf1Replacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    const char* const pEnd = toProcess.data() + toProcess.size();
+    const char* runFrom = toProcess.data(); // not replaced data
+    for (const char* pc = runFrom; pc < pEnd; ++pc)
+    {
+        const size_t index = static_cast<size_t>(*(reinterpret_cast<const unsigned char*>(pc)));
+        if (replaces_[index].present_)
+        {
+            KeepNotReplaced(runFrom, pc);
+            KeepTarget(replaces_[index].trg_);
+            runFrom = pc + 1;
+        }
+    }
+    KeepNotReplaced(runFrom, pEnd);
+    SendOutput();
+
+    // no more data
+    if (aEod)
+    {
+        pNext_->DoReplacements(span<const char>(), aEod);
+    } // if (aEod)
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   processes data by the transducer: one transition for each byte.
+///     Bytes which do not change the root state and are not changed are sent further as they are
+/// </summary>
+class TransducerReplacer final : public ReplacerWithNext
+{
+public:
+    TransducerReplacer(unique_ptr<Transducer>&& transducer)
+        : transducer_(move(transducer))
+        , output_(SZBUFF_FC + max({transducer_->MaxOutput(), notChangedToSendAsIs, Transducer::outputPadding}))
+    {
+        for (size_t c = 0; c < 256; ++c)
+        {
+            const Transducer::Transition& transition = transducer_->Next(0, static_cast<char>(c));
+            const span<const char> output = transducer_->Output(transition);
+            passThrough_[c] = 0 == transition.next_ && 1 == output.size() && static_cast<unsigned char>(output[0]) == c;
+        }
+    }
+
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    /// <summary>
+    ///   sends the output from the beginning of the buffer
+    /// </summary>
+    /// <param name="pOut">the end of the output</param>
+    void SendOutput(const char* const pOut) const
+    {
+        if (pOut > output_.data())
+        {
+            pNext_->DoReplacements(span<const char>(output_.data(), pOut), false);
+        }
+    }
+
+protected:
+    // not changed data is copied to the output when it is shorter
+    static constexpr size_t notChangedToSendAsIs = 64;
+
+    unique_ptr<Transducer> transducer_;
+    bool passThrough_[256] = {}; // the byte stays in the root state and is not changed
+
+    mutable uint32_t state_ = 0; // current state of the transducer
+    mutable vector<char> output_; // output to be sent further as one block
+};
+
+
+void TransducerReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    char* pOut = output_.data();
+    const char* const pOutLimit = output_.data() + SZBUFF_FC;
+    const char* pc = toProcess.data();
+    const char* const pEnd = pc + toProcess.size();
+    while (pc < pEnd)
+    {
+        if (0 == state_ && passThrough_[static_cast<unsigned char>(*pc)])
+        {
+            const char* const pRun = pc;
+            while (++pc < pEnd && passThrough_[static_cast<unsigned char>(*pc)]);
+            if (const size_t runSize = static_cast<size_t>(pc - pRun); runSize >= notChangedToSendAsIs)
+            {
+                SendOutput(pOut);
+                pOut = output_.data();
+                pNext_->DoReplacements(span<const char>(pRun, pc), false);
+            }
+            else
+            {
+                memcpy(pOut, pRun, runSize);
+                pOut += runSize;
+            }
+        }
+        else
+        {
+            const Transducer::Transition& transition = transducer_->Next(state_, *pc++);
+            const span<const char> output = transducer_->Output(transition);
+            if (output.size() <= Transducer::outputPadding) [[likely]]
+            {
+                memcpy(pOut, output.data(), Transducer::outputPadding);
+            }
+            else
+            {
+                memcpy(pOut, output.data(), output.size());
+            }
+            pOut += output.size();
+            state_ = transition.next_;
+        }
+
+        if (pOut >= pOutLimit) [[unlikely]]
+        {
+            SendOutput(pOut);
+            pOut = output_.data();
+        }
+    }
+    SendOutput(pOut);
+
+    // no more data
+    if (aEod)
+    {
+        if (const span<const char> output = transducer_->Final(state_); !output.empty())
+        {
+            pNext_->DoReplacements(output, false);
+        }
+        state_ = 0;
+        pNext_->DoReplacements(span<const char>(), true); // send end of the data further
+    }
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///   translates bytes: all sources and targets are single bytes
+/// </summary>
+class ByteMapReplacer final : public ReplacerWithNext
+{
+public:
+    ByteMapReplacer(const ByteMap& byteMap)
+        : byteMap_(byteMap)
+        , translated_(SZBUFF_FC)
+    {
+    }
+
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
+protected:
+    const ByteMap byteMap_;
+
+    // translated data to be sent further
+    mutable vector<char> translated_;
+};
+
+
+void ByteMapReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
+    {
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+    }
+
+    for (size_t pos = 0; pos < toProcess.size(); pos += translated_.size())
+    {
+        const size_t sz = min(translated_.size(), toProcess.size() - pos);
+        TranslateBytes(toProcess.data() + pos, toProcess.data() + pos + sz, translated_.data(), byteMap_);
+        pNext_->DoReplacements(span<const char>(translated_.data(), sz), false);
+    }
+
+    // no more data
+    if (aEod)
+    {
+        pNext_->DoReplacements(span<const char>(), true);
+    }
+}
 
+
+//--------------------------------------------------
+/// <summary>
+///   deletes bytes and translates the rest of them: all sources are single bytes,
+///     targets are single bytes or empty
+/// </summary>
+class ByteCompactReplacer final : public ReplacerWithNext
+{
 public:
-    /// <summary>
-    ///   creating ChoiceReplacer from provided pairs
-    /// </summary>
-    /// <param name="choice">vector os source & target pairs</param>
-    ChoiceReplacer(StreamReplacerChoice& choice)
+    ByteCompactReplacer(const ByteMap& byteMap, const array<bool, 256>& deleted)
+        : compactor_(byteMap, deleted)
+        , compacted_(SZBUFF_FC + ByteCompactor::outputReserve)
     {
-        size_t bufferSize = 0; // to allocate buffer
-        const size_t sz = choice.size();
-        rpairs_.resize(sz);
-        for (size_t i = 0; i < sz; ++i)
-        {
-            auto& vPair = choice[i]; // copy from
-            auto& rpair = rpairs_[i];// copy to
+    }
 
-            rpair.src_ = vPair.first->access();
-            const size_t sourceSize = rpair.src_.size();
-            if (bufferSize < sourceSize)
-            {
-                bufferSize = sourceSize; // calculate necessary buffer size
-            }
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
 
-            rpair.trg_ = vPair.second->access();
-        }
+protected:
+    const ByteCompactor compactor_;
 
-        cachedData_.resize(bufferSize);
-    }
+    // compacted data to be sent further
+    mutable vector<char> compacted_;
+};
 
-    void DoReplacements(const char toProcess, const bool aEod) const override;
 
-protected:
-    /// <summary>
-    ///    check for partial or full match of the data from cachedData_
-    ///       with any of lexemes sequentially
-    ///       and provides type of the match and index if found
-    /// </summary>
-    /// <param name="indexFrom"> search in pairs from this index</param>
-    /// <param name="fullOnly"> what type of match we want to find : only full or partial also </param>
-    /// <returns>bool: partial, bool: full, size_t: index </returns>
-    tuple<bool, bool, size_t> FindMatch(const size_t indexFrom, const bool fullOnly) const
+void ByteCompactReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
+{
+    if (nullptr == pNext_)
     {
-        for (size_t i = indexFrom; i < rpairs_.size(); ++i)
-        {
-            const auto& srcSpan = rpairs_[i].src_;
-            const size_t cmpLength = (srcSpan.size() > cachedAmount_) ? cachedAmount_ : srcSpan.size();
-
-            if (0 == memcmp(srcSpan.data(), cachedData_.data(), cmpLength))
-            { // match
-                if (cmpLength == srcSpan.size())
-                {
-                    return {false, true, i};
-                }
-                if (!fullOnly)
-                {
-                    return {true, false, i};
-                }
-            }
-            // continue - no match here
-        }
-        return {false, false, 0};
+        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
     }
 
-    /// <summary>
-    ///   Sends target to next replacers, and resets partial match index to zero
-    /// </summary>
-    /// <param name="target">the array we need to send</param>
-    void SendAndResetPartialMatch(const span<const char> target) const
+    for (size_t pos = 0; pos < toProcess.size(); pos += SZBUFF_FC)
     {
-        for (const char c : target)
+        const size_t sz = min(SZBUFF_FC, toProcess.size() - pos);
+        const char* const pEnd = compactor_.Compact(toProcess.data() + pos, toProcess.data() + pos + sz, compacted_.data());
+        if (pEnd > compacted_.data())
         {
-            pNext_->DoReplacements(c, false);
+            pNext_->DoReplacements(span<const char>(compacted_.data(), pEnd), false);
         }
-        indexOfPartialMatch_ = 0;
     }
 
-    /// <summary>
-    ///   Clean srcMatchedLength bytes of cache from the beginning
-    /// </summary>
-    /// <param name="srcMatchedLength">number of bytes we have to clear</param>
-    void CleanTheCache(size_t srcMatchedLength) const
+    // no more data
+    if (aEod)
     {
-        shift_left(cachedData_.data(),
-            cachedData_.data() + cachedAmount_,
-            static_cast<std::iterator_traits<decltype(cachedData_.data())>::difference_type>(srcMatchedLength));
-        cachedAmount_ -= srcMatchedLength;
+        pNext_->DoReplacements(span<const char>(), true);
     }
+}
 
-    /// <summary>
-    ///   The end of the data sign has been received and the cached data need to be either send or replaced & send
-    /// </summary>
-    /// <param name="toProcess">character received along with end of data sign</param>
-    void DoReplacementsAtTheEndOfTheData(const char toProcess) const
+
+//--------------------------------------------------
+/// <summary>
+///   replaces single bytes with lexemes: for encoding-like sets which replace most of bytes.
+///     Each byte is written as one 16 bytes store of its slot, and the output position
+///     moves on by the length of the target. Longer targets are sent as they are
+/// </summary>
+class ByteExpandReplacer final : public ReplacerWithNext
+{
+    static constexpr size_t slotSize = 16;
+    static constexpr unsigned char longTarget = numeric_limits<unsigned char>::max();
+
+public:
+    ByteExpandReplacer(StreamReplacerChoice& choice)
+        : output_(SZBUFF_FC + slotSize)
     {
-        while (cachedAmount_ > 0)
+        bool present[256] = {};
+        for (size_t c = 0; c < 256; ++c)
         {
-            const auto [partialMatch, fullMatch, matchPairIndex] = FindMatch(indexOfPartialMatch_, true);
-            if (fullMatch)
+            slots_[c][0] = static_cast<char>(c);
+            lengths_[c] = 1;
+        }
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            const unsigned char src = static_cast<unsigned char>(alpair.first->access()[0]);
+            if (present[src])
             {
-                const auto& rpair = rpairs_[matchPairIndex];
-                SendAndResetPartialMatch(rpair.trg_);
-                CleanTheCache(rpair.src_.size());
+                cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
             }
-            else // No full match -> send 1 char from cache
+            present[src] = true;
+
+            const span<const char>& trg = alpair.second->access();
+            if (trg.size() > slotSize)
             {
-                SendAndResetPartialMatch(std::span<char> (cachedData_.data(), 1));
-                CleanTheCache(1);
+                lengths_[src] = longTarget;
+                longTargets_[src] = trg;
+                continue;
             }
+            memcpy(slots_[src], trg.data(), trg.size());
+            lengths_[src] = static_cast<unsigned char>(trg.size());
         }
-        pNext_->DoReplacements(toProcess, true);
     }
 
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
+
 protected:
-    // our pairs sorted by priority - only one of them could be replaced for concrete pos
-    vector<ChoiceReplacerPair> rpairs_;
+    /// <summary>
+    ///   sends the output accumulated up to the position
+    /// </summary>
+    void SendOutput(const char* const pOut) const
+    {
+        if (pOut > output_.data())
+        {
+            pNext_->DoReplacements(span<const char>(output_.data(), pOut), false);
+        }
+    }
 
-    mutable size_t cachedAmount_ = 0; // we cached this amount of data
-    mutable size_t indexOfPartialMatch_ = 0; // this index from rpairs_ represents last partial match
+protected:
+    alignas(slotSize) char slots_[256][slotSize] = {}; // targets of bytes up to slotSize
+    unsigned char lengths_[256]; // lengths of targets; longTarget for longer ones
+    span<const char> longTargets_[256]; // targets longer than slotSize
 
-    // this is used to hold temporary data while the logic is 
-    // looking for the new beginning of the cached value
-    mutable vector<char> cachedData_;
+    // output is written by slots: slotSize bytes after the accumulated data are accessible
+    mutable vector<char> output_;
 };
 
-void ChoiceReplacer::DoReplacements(const char toProcess, const bool aEod) const
+
+void ByteExpandReplacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
 {
     if (nullptr == pNext_)
     {
         throw logic_error("Replacement chain has been broken. Communicate with maintainer");
     }
 
-    if (aEod) [[unlikely]]
-    {
-        DoReplacementsAtTheEndOfTheData(toProcess);
-        return;
-    }
-
-    cachedData_[cachedAmount_++] = toProcess;
-    while (cachedAmount_ > 0)
+    char* const pOutBegin = output_.data();
+    char* const pOutLimit = pOutBegin + SZBUFF_FC;
+    char* pOut = pOutBegin;
+    const char* const pEnd = toProcess.data() + toProcess.size();
+    for (const char* pc = toProcess.data(); pc < pEnd; ++pc)
     {
-        const auto [partialMatch, fullMatch, matchPairIndex] = FindMatch(indexOfPartialMatch_, false);
-        if (fullMatch)
+        const unsigned char c = static_cast<unsigned char>(*pc);
+        const unsigned char length = lengths_[c];
+        if (longTarget == length) [[unlikely]]
         {
-            const auto& rpair = rpairs_[matchPairIndex];
-            SendAndResetPartialMatch(rpair.trg_);
-            CleanTheCache(rpair.src_.size());
-            return;
+            SendOutput(pOut);
+            pOut = pOutBegin;
+            pNext_->DoReplacements(longTargets_[c], false);
+            continue;
         }
-        if (partialMatch)
+
+        memcpy(pOut, slots_[c], slotSize);
+        pOut += length;
+        if (pOut >= pOutLimit) [[unlikely]]
         {
-            indexOfPartialMatch_ = matchPairIndex;
-            return;
+            SendOutput(pOut);
+            pOut = pOutBegin;
         }
-        // No any match -> send 1 char from cache
-        SendAndResetPartialMatch(std::span<char>(cachedData_.data(), 1));
-        CleanTheCache(1);
+    }
+    SendOutput(pOut);
+
+    // no more data
+    if (aEod)
+    {
+        pNext_->DoReplacements(span<const char>(), true);
     }
 }
 
-namespace
-{
-    static std::string_view warningDuplicatePattern("Warning: Duplicate pattern to replace found. Second lexeme will be ignored.");
-};
 
 //--------------------------------------------------
 /// <summary>
-///   replaces for lexemes of the same length
+///   replaces for lexemes of 2 bytes
+///     Each pair of bytes is the index in the table of targets; targets are packed in one array.
+///     Output is accumulated and sent further in big blocks since targets are usually short
 /// </summary>
-class UniformLexemeReplacer final : public ReplacerWithNext
+class LexemeOf2Replacer final : public ReplacerWithOutput
 {
+    static constexpr uint32_t noTarget = numeric_limits<uint32_t>::max();
+
 public:
-    UniformLexemeReplacer(StreamReplacerChoice& choice, const size_t sz)
-        : cachedData_(sz)
+    LexemeOf2Replacer(StreamReplacerChoice& choice)
     {
+        fill(begin(targets_), end(targets_), noTarget);
         for (AbstractLexemesPair& alpair : choice)
         {
-            const span<const char>& src = alpair.first->access();
-            const span<const char>& trg = alpair.second->access();
-            if (auto result = replaceOptions_.insert(
-                {
-                    string_view(src.data(), src.size()),
-                    string_view(trg.data(), trg.size()),
-                }); !result.second)
+            uint32_t& target = targets_[Index(alpair.first->access().data())];
+            if (noTarget != target)
             {
                 cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
             }
+
+            const span<const char>& trg = alpair.second->access();
+            target = static_cast<uint32_t>(offsets_.size());
+            offsets_.push_back(arena_.size());
+            arena_.insert(arena_.end(), trg.begin(), trg.end());
         }
+        offsets_.push_back(arena_.size()); // the end of the last target
     }
 
-    void DoReplacements(const char toProcess, const bool aEod) const override;
+    void DoReplacements(const span<const char> toProcess, const bool aEod) const override;
 
 protected:
-    // here we hold pairs of sources and targets
-    unordered_map<string_view, string_view> replaceOptions_;
+    /// <summary>
+    ///   index in the table of targets for 2 bytes
+    /// </summary>
+    static size_t Index(const char* const pc) noexcept
+    {
+        return static_cast<unsigned char>(pc[0]) | (static_cast<size_t>(static_cast<unsigned char>(pc[1])) << 8);
+    }
 
-    mutable size_t cachedAmount_ = 0; // we cache this amount of data in the cachedData_
+    /// <summary>
+    ///   target from the arena
+    /// </summary>
+    /// <param name="target">index of the target</param>
+    span<const char> Target(const uint32_t target) const noexcept
+    {
+        return span<const char>(arena_.data() + offsets_[target], arena_.data() + offsets_[target + 1]);
+    }
 
-    // this is used to hold temporary data while the logic is 
-    // looking for the new beginning of the cached value
-    mutable vector<char> cachedData_;
+protected:
+    uint32_t targets_[256 * 256]; // index of the target for each pair of bytes; noTarget if no lexeme
+    vector<size_t> offsets_; // target i is in arena_ from offsets_[i] to offsets_[i + 1]
+    vector<char> arena_; // all targets one by one
+
+    mutable bool cached_ = false; // the last byte of the previous block is cached
+    mutable char cachedByte_ = 0;
 };
 
 
-void UniformLexemeReplacer::DoReplacements(const char toProcess, const bool aEod) const
+void LexemeOf2Replacer::DoReplacements(const span<const char> toProcess, const bool aEod) const
 {
     if (nullptr == pNext_)
     {
         throw logic_error("Replacement chain has been broken. Communicate with maintainer");
     }
 
-    // no more data
-    if (aEod)
+    const char* pc = toProcess.data();
+    const char* const pEnd = pc + toProcess.size();
+
+    if (cached_ && pc < pEnd)
+    {// lexeme could begin in the last byte of the previous block
+        const char lexeme[2] = {cachedByte_, *pc};
+        if (const uint32_t target = targets_[Index(lexeme)]; noTarget != target)
+        {
+            KeepTarget(Target(target));
+            ++pc;
+        }
+        else
+        {
+            output_.push_back(cachedByte_);
+        }
+        cached_ = false;
+    }
+
+    const char* runFrom = pc; // not replaced data
+    for (; pc + 1 < pEnd; ++pc)
     {
-        if (cachedAmount_ > 0)
+        if (const uint32_t target = targets_[Index(pc)]; noTarget != target)
         {
-            for (size_t q = 0; q < cachedAmount_; ++q) { pNext_->DoReplacements(cachedData_[q], false); }
-            cachedAmount_ = 0;
+            KeepNotReplaced(runFrom, pc);
+            KeepTarget(Target(target));
+            runFrom = ++pc + 1;
         }
-        pNext_->DoReplacements(toProcess, aEod); // send end of the data further
-        return;
-    } // if (aEod)
+    }
+    KeepNotReplaced(runFrom, pc);
 
+    if (pc < pEnd)
+    {// the last byte could be the beginning of a lexeme
+        cached_ = true;
+        cachedByte_ = *pc;
+    }
 
-    // set buffer of cached at once
-    char* const& pBuffer = cachedData_.data();
-    pBuffer[cachedAmount_++] = toProcess;
-    if (cachedAmount_ >= cachedData_.size())
-    {
-        if (const auto it = replaceOptions_.find(string_view(pBuffer, cachedAmount_)); it != replaceOptions_.cend())
-        { // found
-            string_view trg = it->second;
-            for (size_t q = 0; q < trg.size(); ++q) { pNext_->DoReplacements(trg[q], false); }
-            cachedAmount_ = 0;
-        }
-        else
-        { // not found
-            pNext_->DoReplacements(pBuffer[0], false); // send 1 char
-            std::shift_left(pBuffer, pBuffer + cachedAmount_--, 1);
+    // no more data
+    if (aEod)
+    {
+        if (cached_)
+        {
+            output_.push_back(cachedByte_);
+            cached_ = false;
         }
+        SendOutput();
+        pNext_->DoReplacements(span<const char>(), true); // send end of the data further
+        return;
     }
+    SendOutput();
 }
 
 
 //--------------------------------------------------
 /// <summary>
-///   replaces for lexemes of the same length
+///   replaces for lexemes of N bytes, 3 <= N <= 8
+///     The window is loaded as one integer. Bitset of mixed source lexemes skips most
+///     of not matching windows, the rest are looked for in the open addressing table
 /// </summary>
-class LexemeOf1Replacer final : public ReplacerWithNext
+template <size_t N>
+class LexemeOfNReplacer final : public StitchedReplacer
 {
+    static_assert(N >= 3 && N <= sizeof(uint64_t));
+
+    using Key = conditional_t<(N <= sizeof(uint32_t)), uint32_t, uint64_t>;
+
+    typedef LexemesTable<Key> Table;
+
 public:
-    LexemeOf1Replacer(StreamReplacerChoice& choice)
+    LexemeOfNReplacer(StreamReplacerChoice& choice)
+        : StitchedReplacer(N)
+        , table_(choice.size())
     {
         for (AbstractLexemesPair& alpair : choice)
         {
-            const size_t index = static_cast<const size_t>(*(reinterpret_cast<const unsigned char*>(alpair.first->access().data())));
-            if (replaces_[index].present_)
+            const Key key = Load(alpair.first->access().data());
+            if (Table::noPair != Find(key))
             {
                 cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+                continue;
             }
-            else
-            {
-                replaces_[index].present_ = true;
-                replaces_[index].trg_ = alpair.second->access();
-            }
+            table_.Insert(Table::Mixed(key), key, static_cast<uint32_t>(targets_.size()));
+            targets_.push_back(alpair.second->access());
         }
     }
 
-    void DoReplacements(const char toProcess, const bool aEod) const override;
-
 protected:
-    struct
-    {
-        bool present_ = false; // if this char is present
-        span<const char> trg_;
-    } replaces_[256];
-};
-
-
-void LexemeOf1Replacer::DoReplacements(const char toProcess, const bool aEod) const
-{
-    if (nullptr == pNext_)
+    /// <summary>
+    ///   loads N bytes as one integer
+    /// </summary>
+    static Key Load(const char* const pc) noexcept
     {
-        throw logic_error("Replacement chain has been broken. Communicate with maintainer");
+        Key key = 0;
+        memcpy(&key, pc, N);
+        return key;
     }
 
-    // no more data
-    if (aEod)
-    {
-        pNext_->DoReplacements(toProcess, aEod);
-        return;
-    } // if (aEod)
-
-    const size_t index = static_cast<size_t>(*(reinterpret_cast<const unsigned char*>(&toProcess)));
-    if (replaces_[index].present_)
+    /// <summary>
+    ///   looks for the source lexeme
+    /// </summary>
+    /// <param name="key">window loaded as one integer</param>
+    /// <returns>index of the target; noPair if there is no such source lexeme</returns>
+    uint32_t Find(const Key key) const noexcept
     {
-        auto& trg = replaces_[index].trg_;
-        for (size_t q = 0; q < trg.size(); ++q) { pNext_->DoReplacements(trg[q], false); }
+        // the key is the whole lexeme
+        return table_.Find(Table::Mixed(key), key, [](const uint32_t) { return true; });
     }
-    else
+
+    const char* Process(const char* pc, const char* const pLimit, const char* const pEnd) const override
     {
-        pNext_->DoReplacements(toProcess, aEod);
+        const char* runFrom = pc; // not replaced data
+        for (; pc < pLimit && pc + N <= pEnd; ++pc)
+        {
+            if (const uint32_t found = Find(Load(pc)); Table::noPair != found)
+            {
+                KeepNotReplaced(runFrom, pc);
+                KeepTarget(targets_[found]);
+                pc += N - 1;
+                runFrom = pc + 1;
+            }
+        }
+        KeepNotReplaced(runFrom, pc);
+        return pc;
     }
-}
+
+protected:
+    Table table_; // source lexemes by keys
+
+    vector<span<const char>> targets_; // targets in order of priority of pairs
+};
 
 
 //--------------------------------------------------
 /// <summary>
 ///   creates replacer for lexemes of the same length
-///     since this fact allows to use unordered_map for faster search
+///     since this fact allows to use rolling hash for faster search
 /// </summary>
 /// <param name="choice">set of pairs of src & trg lexemes - one of which
 ///   can be processed. The one that was found first.</param>
@@ -497,13 +2342,57 @@ void LexemeOf1Replacer::DoReplacements(const char toProcess, const bool aEod) co
 /// <returns>Replacer for building replacement chain</returns>
 unique_ptr<StreamReplacer> CreateEqualLengthReplacer(StreamReplacerChoice& choice, const size_t sz)
 {
-    if (sz == 1)
+    // bytes are copied to the output by slots when most of them are replaced;
+    //   not replaced data is sent as it is otherwise
+    constexpr size_t minBytesToExpand = 32;
+
+    switch (sz)
     {
+    case 1:
+        if (choice.size() >= minBytesToExpand)
+        {
+            return unique_ptr<StreamReplacer>(new ByteExpandReplacer(choice));
+        }
         return unique_ptr<StreamReplacer>(new LexemeOf1Replacer(choice));
+    case 2:
+        return unique_ptr<StreamReplacer>(new LexemeOf2Replacer(choice));
+    case 3:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<3>(choice));
+    case 4:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<4>(choice));
+    case 5:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<5>(choice));
+    case 6:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<6>(choice));
+    case 7:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<7>(choice));
+    case 8:
+        return unique_ptr<StreamReplacer>(new LexemeOfNReplacer<8>(choice));
+    default:
+        return unique_ptr<StreamReplacer>(new UniformLexemeReplacer(choice, sz));
+    }
+}
+
+//--------------------------------------------------
+/// <summary>
+///   creates replacer for long lexemes which shifts the window by blocks
+/// </summary>
+/// <param name="choice">set of pairs of src & trg lexemes - one of which
+///   can be processed. The one that was found first.</param>
+/// <returns>Replacer for building replacement chain</returns>
+static unique_ptr<StreamReplacer> CreateShiftReplacer(StreamReplacerChoice& choice)
+{
+    // blocks of 2 bytes are in windows of too many lexemes, and shifts become short
+    constexpr size_t maxLexemesForShortBlocks = 64;
+
+    if (choice.size() <= maxLexemesForShortBlocks)
+    {
+        return unique_ptr<StreamReplacer>(new WuManberReplacer<2>(choice));
     }
-    return unique_ptr<StreamReplacer>(new UniformLexemeReplacer(choice, sz));
+    return unique_ptr<StreamReplacer>(new WuManberReplacer<3>(choice));
 }
 
+
 //--------------------------------------------------
 /// <summary>
 ///  creates replacer for choose specific lexeme among others to replace
@@ -513,18 +2402,80 @@ unique_ptr<StreamReplacer> CreateEqualLengthReplacer(StreamReplacerChoice& choic
 /// <returns>Replacer for building replacement chain</returns>
 unique_ptr<StreamReplacer> CreateMultipleReplacer(StreamReplacerChoice& choice)
 {
-    const size_t szSrc = choice.cbegin()->first->access().size(); // save size of the first lexeme
+    // the automaton is faster for few lexemes; hashes are checked at every position
+    constexpr size_t minLexemesForBuckets = 64;
+
+    // windows of long lexemes are shifted by blocks instead of checking every position
+    constexpr size_t minSizeForShifts = 16;
 
     // check for sources of the same length
+    set<size_t> sizes;
+    for (const AbstractLexemesPair& alpair: choice)
+    {
+        sizes.insert(alpair.first->access().size());
+    }
+
+    if (*sizes.cbegin() >= minSizeForShifts)
+    {
+        return CreateShiftReplacer(choice);
+    }
+    if (sizes.size() == 1)
+    {
+        return CreateEqualLengthReplacer(choice, *sizes.cbegin()); // create optimized replacer for lexemes of the same length
+    }
+    if (sizes.size() <= LengthBucketReplacer::maxBuckets && choice.size() > minLexemesForBuckets)
+    {
+        return unique_ptr<StreamReplacer>(new LengthBucketReplacer(choice));
+    }
+    return CreateChoiceReplacer(choice);
+}
+
+
+//--------------------------------------------------
+/// <summary>
+///  checks if the choice deletes and translates bytes: all sources are single bytes,
+///    targets are single bytes or empty
+/// </summary>
+/// <param name="choice">set of pairs of src & trg lexemes</param>
+/// <param name="byteMap">translation of bytes by the choice; bytes without sources stay the same</param>
+/// <param name="deleted">bytes deleted by the choice</param>
+/// <returns>true if the choice deletes and translates bytes</returns>
+static bool ByteCompactionOf(StreamReplacerChoice& choice, ByteMap& byteMap, array<bool, 256>& deleted)
+{
     for (const AbstractLexemesPair& alpair: choice)
     {
-        if (alpair.first->access().size() != szSrc)
+        if (alpair.first->access().size() != 1 || alpair.second->access().size() > 1)
         {
-            return unique_ptr<StreamReplacer>(new ChoiceReplacer(choice));
+            return false;
         }
     }
 
-    return CreateEqualLengthReplacer(choice, szSrc); // create optimized replacer for lexemes of the same length
+    for (size_t i = 0; i < byteMap.size(); ++i)
+    {
+        byteMap[i] = static_cast<unsigned char>(i);
+    }
+    deleted.fill(false);
+
+    bool present[256] = {};
+    for (const AbstractLexemesPair& alpair: choice)
+    {
+        const unsigned char src = static_cast<unsigned char>(alpair.first->access()[0]);
+        if (present[src])
+        {
+            cout << coloredconsole::toconsole(warningDuplicatePattern) << endl;
+            continue;
+        }
+        present[src] = true;
+        if (const span<const char>& trg = alpair.second->access(); trg.empty())
+        {
+            deleted[src] = true;
+        }
+        else
+        {
+            byteMap[src] = static_cast<unsigned char>(trg[0]);
+        }
+    }
+    return true;
 }
 
 
@@ -537,6 +2488,15 @@ unique_ptr<StreamReplacer> StreamReplacer::CreateReplacer(StreamReplacerChoice&
             throw logic_error("Pattern to replace cannot be empty");
     }
 
+    if (ByteMap byteMap; ByteMapOf(choice, byteMap))
+    {
+        return CreateByteMapReplacer(byteMap);
+    }
+    else if (array<bool, 256> deleted; ByteCompactionOf(choice, byteMap, deleted))
+    {
+        return unique_ptr<StreamReplacer>(new ByteCompactReplacer(byteMap, deleted));
+    }
+
     if (choice.size() == 1)
     {
         const AbstractLexemesPair& alexemesPair = *choice.cbegin();
@@ -545,4 +2505,33 @@ unique_ptr<StreamReplacer> StreamReplacer::CreateReplacer(StreamReplacerChoice&
     return CreateMultipleReplacer(choice);
 }
 
+
+//--------------------------------------------------
+bool StreamReplacer::ByteMapOf(StreamReplacerChoice& choice, ByteMap& byteMap)
+{
+    for (const AbstractLexemesPair& alpair: choice)
+    {
+        if (alpair.second->access().size() != 1)
+        {
+            return false;
+        }
+    }
+
+    array<bool, 256> deleted;
+    return ByteCompactionOf(choice, byteMap, deleted);
+}
+
+
+//--------------------------------------------------
+unique_ptr<StreamReplacer> StreamReplacer::CreateByteMapReplacer(const ByteMap& byteMap)
+{
+    return unique_ptr<StreamReplacer>(new ByteMapReplacer(byteMap));
+}
+
+
+unique_ptr<StreamReplacer> StreamReplacer::CreateTransducerReplacer(unique_ptr<Transducer>&& transducer)
+{
+    return unique_ptr<StreamReplacer>(new TransducerReplacer(move(transducer)));
+}
+
 }; // namespace bpatch
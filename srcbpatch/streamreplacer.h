@@ -1,5 +1,7 @@
 #pragma once
+#include "bytetranslation.h"
 #include <memory>
+#include <span>
 #include <utility>
 #include <vector>
 
@@ -10,6 +12,7 @@ namespace bpatch
 /// </summary>
 class Writer;
 class AbstractBinaryLexeme;
+class Transducer;
 
 
 /// <summary>
@@ -31,12 +34,23 @@ typedef std::vector<AbstractLexemesPair> StreamReplacerChoice;
 struct StreamReplacer
 {
     /// <summary>
-    ///   callback from StreamReplacer
+    ///   callback from StreamReplacer. Processes whole block of data at once
+    /// </summary>
+    /// <param name="toProcess">block of data - next in sequence. Could be empty</param>
+    /// <param name="aEod">this is sign that no more data after the 'toProcess' block</param>
+    virtual void DoReplacements(const std::span<const char> toProcess, const bool aEod) const = 0;
+
+
+    /// <summary>
+    ///   callback from StreamReplacer. Adapter for byte by byte processing
     /// </summary>
     /// <param name="toProcess">char - next in sequence</param>
     /// <param name="aEod">this is sign that no more data,
     ///   current char 'toProcess' is not valid if aEod is true</param>
-    virtual void DoReplacements(const char toProcess, const bool aEod) const = 0;
+    void DoReplacements(const char toProcess, const bool aEod) const
+    {
+        DoReplacements(aEod ? std::span<const char>() : std::span<const char>(&toProcess, 1), aEod);
+    }
 
 
     /// <summary>
@@ -71,6 +85,31 @@ static std::unique_ptr<StreamReplacer> ReplacerLastInChain(Writer* const pWriter
 /// <returns>Replacer for building replacement chain</returns>
 static std::unique_ptr<StreamReplacer> CreateReplacer(StreamReplacerChoice& choice);
 
+
+/// <summary>
+///  checks if the choice just translates bytes: all sources and targets are single bytes
+/// </summary>
+/// <param name="choice">set of pairs of src & trg lexemes</param>
+/// <param name="byteMap">translation of bytes by the choice; bytes without sources stay the same</param>
+/// <returns>true if the choice is translation of bytes</returns>
+static bool ByteMapOf(StreamReplacerChoice& choice, ByteMap& byteMap);
+
+
+/// <summary>
+///  creates replacer for translation of bytes
+/// </summary>
+/// <param name="byteMap">each byte is replaced with the byte at its index</param>
+/// <returns>Replacer for building replacement chain</returns>
+static std::unique_ptr<StreamReplacer> CreateByteMapReplacer(const ByteMap& byteMap);
+
+
+/// <summary>
+///  creates replacer which processes data by the transducer
+/// </summary>
+/// <param name="transducer">replacements of consecutive 'replace' objects composed together</param>
+/// <returns>Replacer for building replacement chain</returns>
+static std::unique_ptr<StreamReplacer> CreateTransducerReplacer(std::unique_ptr<Transducer>&& transducer);
+
 };
 
 };// namespace bpatch
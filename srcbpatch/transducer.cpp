@@ -0,0 +1,259 @@
+#include "stdafx.h"
+#include "binarylexeme.h"
+#include "choiceautomaton.h"
+#include "transducer.h"
+
+namespace bpatch
+{
+using namespace std;
+
+namespace
+{
+/// <summary>
+///   replacements of the choice over states of the automaton, the same as ChoiceReplacer does them
+/// </summary>
+class ChoiceSteps final
+{
+public:
+    ChoiceSteps(const vector<span<const char>>& sources, StreamReplacerChoice& choice)
+        : automaton_(sources)
+    {
+        for (AbstractLexemesPair& alpair : choice)
+        {
+            rpairs_.push_back({alpair.first->access(), alpair.second->access()});
+        }
+    }
+
+    /// <summary>
+    ///   processes the byte in the state
+    /// </summary>
+    /// <param name="state">the state of the automaton</param>
+    /// <param name="c">the byte</param>
+    /// <param name="output">output of the processing is appended here</param>
+    /// <returns>the next state</returns>
+    uint32_t Step(uint32_t state, const char c, vector<char>& output) const
+    {
+        for (;;)
+        {
+            const ChoiceAutomaton::State& current = automaton_[state];
+            const span<const char> data = automaton_.StateData(state);
+            const uint32_t next = automaton_.Transition(state, c);
+
+            // this amount of data is not represented by the next state
+            const size_t leaving = current.depth_ + 1 - automaton_[next].depth_;
+            if (ChoiceAutomaton::noMatch == current.matchLexeme_ || current.matchOffset_ >= leaving)
+            {// no match became final
+                output.insert(output.end(), data.begin(), data.begin() + min(leaving, data.size()));
+                if (leaving > data.size())
+                {
+                    output.push_back(c);
+                }
+                return next;
+            }
+
+            // the byte is processed again after the match
+            const auto& [src, trg] = rpairs_[current.matchLexeme_];
+            output.insert(output.end(), data.begin(), data.begin() + current.matchOffset_);
+            output.insert(output.end(), trg.begin(), trg.end());
+            state = Walk(data, current.matchOffset_ + src.size(), 0, false, output);
+        }
+    }
+
+    /// <summary>
+    ///   processes the end of the data in the state
+    /// </summary>
+    /// <param name="state">the state of the automaton</param>
+    /// <param name="output">output of the processing is appended here</param>
+    void Final(const uint32_t state, vector<char>& output) const
+    {
+        const span<const char> data = automaton_.StateData(state);
+        Walk(data, data.size(), state, true, output);
+    }
+
+protected:
+    /// <summary>
+    ///   searches the data from the position
+    /// </summary>
+    /// <param name="data">data represented by a state</param>
+    /// <param name="position">next byte to process</param>
+    /// <param name="state">the state for the data before the position</param>
+    /// <param name="atEnd">the data is the end of the stream: the search is complete</param>
+    /// <param name="output">output of the search is appended here</param>
+    /// <returns>the state which represents the end of the data</returns>
+    uint32_t Walk(const span<const char> data, size_t position, uint32_t state, const bool atEnd, vector<char>& output) const
+    {
+        for (;;)
+        {
+            const ChoiceAutomaton::State& current = automaton_[state];
+            const size_t regionBegin = position - current.depth_; // where the data of the state begins
+            uint32_t next = 0;
+            size_t leaving = current.depth_; // the end of the data: all data leaves the state
+            if (position < data.size())
+            {
+                next = automaton_.Transition(state, data[position]);
+                leaving = current.depth_ + 1 - automaton_[next].depth_;
+            }
+            else if (!atEnd || 0 == state)
+            {
+                return state;
+            }
+
+            if (ChoiceAutomaton::noMatch != current.matchLexeme_ && current.matchOffset_ < leaving)
+            {// the match is final - do replacement, and search again after it
+                const auto& [src, trg] = rpairs_[current.matchLexeme_];
+                output.insert(output.end(), data.begin() + regionBegin, data.begin() + regionBegin + current.matchOffset_);
+                output.insert(output.end(), trg.begin(), trg.end());
+                position = regionBegin + current.matchOffset_ + src.size();
+                state = 0;
+                continue;
+            }
+
+            output.insert(output.end(), data.begin() + regionBegin, data.begin() + regionBegin + leaving);
+            state = next;
+            ++position;
+        }
+    }
+
+protected:
+    TableChoiceAutomaton automaton_;
+
+    // pairs of sources and targets in order of priority
+    vector<pair<span<const char>, span<const char>>> rpairs_;
+};
+
+};// namespace
+
+
+bool Transducer::SetOutput(const span<const char> output, Transition& transition)
+{
+    if (arena_.size() + output.size() > numeric_limits<uint32_t>::max())
+    {
+        return false;
+    }
+    transition.outputFrom_ = static_cast<uint32_t>(arena_.size());
+    arena_.insert(arena_.end(), output.begin(), output.end());
+    transition.outputTo_ = static_cast<uint32_t>(arena_.size());
+    maxOutput_ = max(maxOutput_, output.size());
+    return true;
+}
+
+
+unique_ptr<Transducer> Transducer::FromChoice(StreamReplacerChoice& choice, const size_t maxStates)
+{
+    vector<span<const char>> sources;
+    size_t sourcesSize = 0; // states of the automaton are not more than bytes of sources
+    for (const AbstractLexemesPair& alpair : choice)
+    {
+        sources.push_back(alpair.first->access());
+        sourcesSize += sources.back().size();
+        if (sources.back().empty() || sourcesSize >= maxStates)
+        {
+            return nullptr;
+        }
+    }
+
+    const ChoiceSteps steps(sources, choice);
+
+    // states of the transducer are found from the root, as they are reached
+    unique_ptr<Transducer> result(new Transducer);
+    unordered_map<uint32_t, uint32_t> states{{0, 0}}; // state of the automaton -> state of the transducer
+    vector<uint32_t> toProcess{0}; // states of the automaton by states of the transducer
+    vector<char> output;
+    for (size_t i = 0; i < toProcess.size(); ++i)
+    {
+        result->transitions_.resize(result->transitions_.size() + 256);
+        for (size_t c = 0; c < 256; ++c)
+        {
+            output.clear();
+            const uint32_t next = steps.Step(toProcess[i], static_cast<char>(c), output);
+            const auto [it, added] = states.emplace(next, static_cast<uint32_t>(toProcess.size()));
+            if (added)
+            {
+                toProcess.push_back(next);
+            }
+
+            Transition& transition = result->transitions_[i * 256 + c];
+            transition.next_ = it->second;
+            if (!result->SetOutput(output, transition))
+            {
+                return nullptr;
+            }
+        }
+
+        output.clear();
+        steps.Final(toProcess[i], output);
+        result->finals_.emplace_back();
+        if (!result->SetOutput(output, result->finals_.back()))
+        {
+            return nullptr;
+        }
+    }
+    result->Complete();
+    return result;
+}
+
+
+unique_ptr<Transducer> Transducer::Compose(const Transducer& first, const Transducer& second, const size_t maxStates)
+{
+    // states are pairs of states of both transducers, they are found from the root as they are reached
+    unique_ptr<Transducer> result(new Transducer);
+    unordered_map<uint64_t, uint32_t> states{{0, 0}};
+    vector<pair<uint32_t, uint32_t>> toProcess{{0, 0}};
+    vector<char> output;
+
+    // output of the first transducer is processed by the second one
+    auto passThrough = [&second, &output](const span<const char> data, uint32_t state)
+    {
+        for (const char c : data)
+        {
+            const Transition& transition = second.Next(state, c);
+            const span<const char> out = second.Output(transition);
+            output.insert(output.end(), out.begin(), out.end());
+            state = transition.next_;
+        }
+        return state;
+    };
+
+    for (size_t i = 0; i < toProcess.size(); ++i)
+    {
+        const auto [firstState, secondState] = toProcess[i];
+        result->transitions_.resize(result->transitions_.size() + 256);
+        for (size_t c = 0; c < 256; ++c)
+        {
+            output.clear();
+            const Transition& firstTransition = first.Next(firstState, static_cast<char>(c));
+            const uint32_t secondNext = passThrough(first.Output(firstTransition), secondState);
+
+            const uint64_t key = (static_cast<uint64_t>(firstTransition.next_) << 32) | secondNext;
+            const auto [it, added] = states.emplace(key, static_cast<uint32_t>(toProcess.size()));
+            if (added)
+            {
+                if (toProcess.size() >= maxStates)
+                {
+                    return nullptr;
+                }
+                toProcess.emplace_back(firstTransition.next_, secondNext);
+            }
+
+            Transition& transition = result->transitions_[i * 256 + c];
+            transition.next_ = it->second;
+            if (!result->SetOutput(output, transition))
+            {
+                return nullptr;
+            }
+        }
+
+        output.clear();
+        const span<const char> secondFinal = second.Final(passThrough(first.Final(firstState), secondState));
+        output.insert(output.end(), secondFinal.begin(), secondFinal.end());
+        result->finals_.emplace_back();
+        if (!result->SetOutput(output, result->finals_.back()))
+        {
+            return nullptr;
+        }
+    }
+    result->Complete();
+    return result;
+}
+
+};// namespace bpatch
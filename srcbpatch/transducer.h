@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "streamreplacer.h"
+
+namespace bpatch
+{
+/// <summary>
+///   deterministic transducer: each byte moves it to the next state and produces output.
+///     Output of the state is produced at the end of the data.
+///   Replacements by one 'replace' object are the transducer over states of its
+///     Aho-Corasick automaton; consecutive replacements are composed into one transducer
+/// </summary>
+class Transducer final
+{
+public:
+    // outputs are followed by this amount of accessible bytes: short outputs are copied by fixed size
+    static constexpr std::size_t outputPadding = 8;
+
+    struct Transition
+    {
+        uint32_t next_ = 0; // the next state
+        uint32_t outputFrom_ = 0; // output is in the arena from outputFrom_ to outputTo_
+        uint32_t outputTo_ = 0;
+    };
+
+public:
+    /// <summary>
+    ///   creates the transducer for replacements of the choice
+    /// </summary>
+    /// <param name="choice">set of pairs of src & trg lexemes; pairs found first win</param>
+    /// <param name="maxStates">the limit of states of the transducer</param>
+    /// <returns>the transducer; nullptr if it needs more states, or the choice has empty source</returns>
+    static std::unique_ptr<Transducer> FromChoice(StreamReplacerChoice& choice, const std::size_t maxStates);
+
+    /// <summary>
+    ///   creates the transducer which applies the second transducer to the output of the first one
+    /// </summary>
+    /// <param name="first">the transducer for the data</param>
+    /// <param name="second">the transducer for the output of the first one</param>
+    /// <param name="maxStates">the limit of states of the transducer</param>
+    /// <returns>the transducer; nullptr if it needs more states</returns>
+    static std::unique_ptr<Transducer> Compose(const Transducer& first, const Transducer& second, const std::size_t maxStates);
+
+    std::size_t StatesCount() const noexcept
+    {
+        return finals_.size();
+    }
+
+    /// <summary>
+    ///   transition of the state by the byte
+    /// </summary>
+    const Transition& Next(const uint32_t state, const char c) const noexcept
+    {
+        return transitions_[state * 256 + static_cast<unsigned char>(c)];
+    }
+
+    /// <summary>
+    ///   output of the transition
+    /// </summary>
+    std::span<const char> Output(const Transition& transition) const noexcept
+    {
+        return std::span<const char>(arena_.data() + transition.outputFrom_, arena_.data() + transition.outputTo_);
+    }
+
+    /// <summary>
+    ///   output of the state at the end of the data
+    /// </summary>
+    std::span<const char> Final(const uint32_t state) const noexcept
+    {
+        return Output(finals_[state]);
+    }
+
+    /// <summary>
+    ///   the longest output of transitions
+    /// </summary>
+    std::size_t MaxOutput() const noexcept
+    {
+        return maxOutput_;
+    }
+
+protected:
+    /// <summary>
+    ///   keeps the output in the arena
+    /// </summary>
+    /// <param name="output">the output</param>
+    /// <param name="transition">transition to set the output for</param>
+    /// <returns>false if the arena is too big</returns>
+    bool SetOutput(const std::span<const char> output, Transition& transition);
+
+    /// <summary>
+    ///   adds padding after all outputs
+    /// </summary>
+    void Complete()
+    {
+        arena_.resize(arena_.size() + outputPadding);
+    }
+
+protected:
+    std::vector<Transition> transitions_; // transitions_[state * 256 + byte]
+    std::vector<Transition> finals_; // output at the end of the data; next_ is not used
+    std::vector<char> arena_; // all outputs
+    std::size_t maxOutput_ = 0;
+};
+
+};// namespace bpatch
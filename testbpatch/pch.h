@@ -6,9 +6,11 @@
 
 #include "actionscollection.h"
 #include "binarylexeme.h"
+#include "choiceautomaton.h"
 #include "consoleparametersreader.h"
 #include "dictionary.h"
 #include "dictionarykeywords.h"
+#include "fdprocessing.h"
 #include "fileprocessing.h"
 #include "flexiblecache.h"
 #include "jsonparser.h"
@@ -4,6 +4,7 @@
 
 
 #if defined(__linux__) || ((defined(__APPLE__) && defined(__MACH__)))
+#include <fcntl.h>
 #include <unistd.h>
 #else
 #include <tchar.h>
@@ -352,6 +353,42 @@ TEST(FlexibleCache, LinkedList)
     }
 }
 
+/// <summary>
+///   both automata for the choice of lexemes should walk through the same data
+///     and find the same matches
+/// </summary>
+TEST(ChoiceAutomaton, TableAndDoubleArray)
+{
+    using namespace bpatch;
+    using namespace std;
+
+    const vector<string> lexemesData = {"abcd", "b", "bcx", "cxy", "abcxyz", "xyz", "b", "aaab", "ba", "zzzzz", "az"};
+    vector<span<const char>> lexemes;
+    for (const string& lexeme : lexemesData)
+    {
+        lexemes.emplace_back(lexeme.data(), lexeme.size());
+    }
+
+    const TableChoiceAutomaton table(lexemes);
+    const DoubleArrayChoiceAutomaton doubleArray(lexemes);
+
+    const string_view data = "abcxabcdabcxyzabcxyabcbcxyzxyzabc aaaab zzzzzzbaz qwerty bcxbazzzzz";
+    uint32_t tableState = 0;
+    uint32_t doubleArrayState = 0;
+    for (const char c : data)
+    {
+        tableState = table.Transition(tableState, c);
+        doubleArrayState = doubleArray.Transition(doubleArrayState, c);
+
+        const span<const char> tableData = table.StateData(tableState);
+        const span<const char> doubleArrayData = doubleArray.StateData(doubleArrayState);
+        EXPECT_EQ(string_view(tableData.data(), tableData.size()), string_view(doubleArrayData.data(), doubleArrayData.size()));
+        EXPECT_EQ(table[tableState].matchLexeme_, doubleArray[doubleArrayState].matchLexeme_);
+        EXPECT_EQ(table[tableState].matchOffset_, doubleArray[doubleArrayState].matchOffset_);
+    }
+}
+
+
 /// <summary>
 ///   replace logic for the lexemes
 ///     life time of the data for lexemes should be the same or longer
@@ -912,6 +949,106 @@ TEST(ACollection, ReusageOfActionsCollection)
 }
 
 
+/// <summary>
+///    Output of a stage which is bigger than a block is processed by the next stages in parts
+/// </summary>
+///
+TEST(ACollection, StageOutputBiggerThanBlock)
+{
+    using namespace std;
+    using namespace bpatch;
+
+    string_view action =
+    R"(
+        {"dictionary":
+            {"text":
+                {"a":"a", "b":"b", "cd":"cd", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb":"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"}
+            },
+         "todo":
+        [
+            { "replace": { "a": "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb" } },
+            { "replace": { "b": "cd" } }
+        ]}
+    )";
+
+    const string data(SZBUFF_FC / 8, 'a');
+    for (const size_t maxFusedStates : {size_t(0), ActionsCollection::suggestedMaxFusedStates})
+    {
+        vector<char> vec(begin(action), end(action));
+        ActionsCollection ac(move(vec), maxFusedStates); // processor
+
+        TestWriter tw;
+        ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&tw));
+        ac.DoReplacements(span<const char>(data), false);
+        ac.DoReplacements(span<const char>(data.data(), 1), true);
+
+        ASSERT_EQ(tw.data_accumulator.size(), (data.size() + 1) * 64) << "fused states " << maxFusedStates;
+        for (size_t i = 0; i < tw.data_accumulator.size(); i += 2)
+        {
+            ASSERT_TRUE(tw.data_accumulator[i] == 'c' && tw.data_accumulator[i + 1] == 'd') << "position " << i;
+        }
+    }
+}
+
+
+/// <summary>
+///    Regions without sources between bytes out of sources are unchanged,
+///  replaces could be completed before them and started again after them
+/// </summary>
+TEST(ACollection, UnchangedRegion)
+{
+    using namespace std;
+    using namespace bpatch;
+
+    string_view action =
+    R"(
+        {"dictionary":
+            {"text":
+                {"ab":"ab", "x":"x", "xc":"xc", "Q":"Q"}
+            },
+         "todo":
+        [
+            { "replace": { "ab": "x" } },
+            { "replace": { "xc": "Q" } }
+        ]}
+    )";
+
+    const string data = string(200, '.') + "abc" + string(1000, '-') + "xabc" + string(300, '.');
+    vector<char> vec(begin(action), end(action));
+    ActionsCollection ac(move(vec)); // processor
+
+    const span<const char> region = ac.UnchangedRegion(data, 100);
+    ASSERT_EQ(region.data(), data.data());
+    ASSERT_EQ(region.size(), 200u);
+
+    const span<const char> next = ac.UnchangedRegion(span<const char>(data).subspan(203), 100);
+    ASSERT_EQ(next.data(), data.data() + 203);
+    ASSERT_EQ(next.size(), 1000u);
+
+    ASSERT_TRUE(ac.UnchangedRegion(data, 2000).empty());
+
+    TestWriter whole;
+    ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&whole));
+    ac.DoReplacements(span<const char>(data), true);
+    const string expected = string(200, '.') + "Q" + string(1000, '-') + "xQ" + string(300, '.');
+    ASSERT_EQ(string(whole.data_accumulator.begin(), whole.data_accumulator.end()), expected);
+
+    // regions are taken as is
+    TestWriter parts;
+    ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&parts));
+    span<const char> rest(data);
+    for (span<const char> r; !(r = ac.UnchangedRegion(rest, 100)).empty();)
+    {
+        const size_t before = static_cast<size_t>(r.data() - rest.data());
+        ac.DoReplacements(rest.first(before), true);
+        parts.data_accumulator.insert(parts.data_accumulator.end(), r.begin(), r.end());
+        rest = rest.subspan(before + r.size());
+    }
+    ac.DoReplacements(rest, true);
+    ASSERT_EQ(parts.data_accumulator, whole.data_accumulator);
+}
+
+
 /// <summary>
 ///    We need to prove that second usage of ActionsCollection class
 ///  will provide the same result
@@ -1181,6 +1318,750 @@ TEST(ACollection, MultipleUsageOfProcessing)
 }
 
 
+/// <summary>
+///    Data could be sent into ActionsCollection by blocks of any size.
+///  Result must be the same as for byte by byte processing
+/// </summary>
+///
+TEST(ACollection, BlockProcessing)
+{
+    TestData arrTests[] = {
+        {
+        R"(
+            {"dictionary":{"text":{"aab":"aab", "X":"X", "ab":"ab", "b":"b", "-":"-", "abc":"abc", "-bb":"-bb", "a":"a", "0":"0", "1":"1"}},
+                           "todo":
+            [
+                {
+                    "replace": { "aab": "X" }
+                }
+                , {
+                    "replace": { "ab": "-", "b": "abc" }
+                }
+                , {
+                    "replace": { "abc": "1", "-bb": "0" }
+                }
+                , {
+                    "replace": { "a": "b" }
+                }
+            ]}
+        )",
+        R"(aaabaabXab-bbaaaabaaab)",
+        R"(bXXX--11bbXbX)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"abcd":"abcd", "b":"b", "bcx":"bcx", "cxy":"cxy", "abcxyz":"abcxyz", "xyz":"xyz",
+                                   "1":"1", "2":"2", "3":"3", "4":"4", "5":"5", "6":"6"}},
+                           "todo":
+            [
+                {
+                    "replace": { "abcd": "1", "b": "2", "bcx": "3", "cxy": "4", "abcxyz": "5", "xyz": "6" }
+                }
+            ]}
+        )",
+        R"(abcxabcdabcxyzabcxyabcbcxyzxyzabc)",
+        R"(a2cx15a24a2c24z6a2c)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"abc":"abc", "bca":"bca", "cab":"cab", "aaa":"aaa", "1":"1", "2":"2", "3":"3", "4":"4"}},
+                           "todo":
+            [
+                {
+                    "replace": { "abc": "1", "bca": "2", "cab": "3", "aaa": "4" }
+                }
+            ]}
+        )",
+        R"(xabcabcaaaaabcaxbcaabcabx)",
+        R"(x114a1ax21abx)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"aaaab":"aaaab", "ab":"ab", "a":"a", "X":"X", "Y":"Y", "-":"-"}},
+                           "todo":
+            [
+                {
+                    "replace": { "aaaab": "X", "ab": "Y", "a": "-" }
+                }
+            ]}
+        )",
+        R"(aaaaaaabaaaabaaabaaaaxaaaaab)",
+        R"(---XX--Y----x-X)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"abab":"abab", "bcde":"bcde", "hhha":"hhha", "aa":"aa", "ab":"ab", "ac":"ac", "ad":"ad", "ae":"ae", "af":"af", "ag":"ag", "ah":"ah",
+                                   "ba":"ba", "bb":"bb", "bc":"bc", "bd":"bd", "be":"be", "bf":"bf", "bg":"bg", "bh":"bh", "ca":"ca", "cb":"cb", "cc":"cc", "cd":"cd",
+                                   "ce":"ce", "cf":"cf", "cg":"cg", "ch":"ch", "da":"da", "db":"db", "dc":"dc", "dd":"dd", "de":"de", "df":"df", "cdcd":"cdcd",
+                                   "aaab":"aaab", "dcba":"dcba", "dg":"dg", "dh":"dh", "ea":"ea", "eb":"eb", "ec":"ec", "ed":"ed", "ee":"ee", "ef":"ef", "eg":"eg",
+                                   "eh":"eh", "fa":"fa", "fb":"fb", "fc":"fc", "fd":"fd", "fe":"fe", "ff":"ff", "fg":"fg", "fh":"fh", "ga":"ga", "gb":"gb", "gc":"gc",
+                                   "gd":"gd", "ge":"ge", "gf":"gf", "gg":"gg", "gh":"gh", "ha":"ha", "hb":"hb", "hc":"hc", "hd":"hd",
+                                   "0":"0", "1":"1", "2":"2", "3":"3", "4":"4", "5":"5", "6":"6", "7":"7", "8":"8", "9":"9"}},
+                           "todo":
+            [
+                {
+                    "replace": { "abab": "0", "bcde": "1", "hhha": "2", "aa": "3", "ab": "4", "ac": "5", "ad": "6", "ae": "7", "af": "8", "ag": "9", "ah": "0",
+                                 "ba": "1", "bb": "2", "bc": "3", "bd": "4", "be": "5", "bf": "6", "bg": "7", "bh": "8", "ca": "9", "cb": "0", "cc": "1", "cd": "2",
+                                 "ce": "3", "cf": "4", "cg": "5", "ch": "6", "da": "7", "db": "8", "dc": "9", "dd": "0", "de": "1", "df": "2", "cdcd": "3",
+                                 "aaab": "4", "dcba": "5", "dg": "6", "dh": "7", "ea": "8", "eb": "9", "ec": "0", "ed": "1", "ee": "2", "ef": "3", "eg": "4",
+                                 "eh": "5", "fa": "6", "fb": "7", "fc": "8", "fd": "9", "fe": "0", "ff": "1", "fg": "2", "fh": "3", "ga": "4", "gb": "5", "gc": "6",
+                                 "gd": "7", "ge": "8", "gf": "9", "gg": "0", "gh": "1", "ha": "2", "hb": "3", "hc": "4", "hd": "5" }
+                }
+            ]}
+        )",
+        R"(ababxbcdehhhaacdcdaaabdcbaxxhhhhgfedcbabab)",
+        R"(0x12597340axxhhhh9100)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"long":"0123456789abcdefXY", "short":"0123456789abcdef", "back":"fedcba9876543210", "shifted":"9abcdef0123456789abcdefX",
+                                   "A":"A", "B":"B", "C":"C", "D":"D"}},
+                           "todo":
+            [
+                {
+                    "replace": { "long": "A", "short": "B", "back": "C", "shifted": "D" }
+                }
+            ]}
+        )",
+        R"(x0123456789abcdefXY0123456789abcdef0123456789abcdefXfedcba98765432109abcdef0123456789abcdefXy0123456789abcde)",
+        R"(xABBXCDy0123456789abcde)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"ab":"ab", "ba":"ba", "aa":"aa", "bb":"bb", "X":"X", "-":"-", "YY":"YY", "empty":""}},
+                           "todo":
+            [
+                {
+                    "replace": { "ab": "X", "ba": "-", "aa": "YY", "bb": "empty" }
+                }
+            ]}
+        )",
+        R"(abaababbbaaaxbab)",
+        R"(XYY--YYx-b)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"0123456789":"0123456789", "1234567890":"1234567890", "9012345678":"9012345678", "A":"A", "B":"B", "C":"C"}},
+                           "todo":
+            [
+                {
+                    "replace": { "0123456789": "A", "1234567890": "B", "9012345678": "C" }
+                }
+            ]}
+        )",
+        R"(x01234567890123456789012345678901234567x9012345678)",
+        R"(xAAA01234567xC)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"a":"a", "b":"b", "c":"c", "x":"x", "ab":"ab", "X":"X", "Y":"Y", "YY":"YY"}},
+                           "todo":
+            [
+                {
+                    "replace": { "a": "b", "b": "c", "a": "x" }
+                }
+                , {
+                    "replace": { "c": "a" }
+                }
+                , {
+                    "replace": { "ab": "X", "c": "YY" }
+                }
+                , {
+                    "replace": { "X": "a", "Y": "b" }
+                }
+                , {
+                    "replace": { "b": "c" }
+                }
+            ]}
+        )",
+        R"(abcabcxyzaabbcc)",
+        R"(caaaaxyzccaaaa)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"a":"a", "b":"b", "c":"c", "x":"x", "empty":""}},
+                           "todo":
+            [
+                {
+                    "replace": { "a": "empty", "b": "c", "c": "empty", "b": "empty" }
+                }
+            ]}
+        )",
+        R"(abcabcxyzaabbccaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbx)",
+        R"(ccxyzccccccccccccccccccccccccccccccccccccccccccccccx)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"a":"a", "b":"b", "c":"c", "d":"d", "e":"e", "f":"f", "g":"g", "h":"h", "i":"i", "j":"j", "k":"k", "l":"l", "m":"m", "n":"n", "o":"o", "p":"p", "q":"q", "r":"r", "s":"s", "t":"t", "u":"u", "v":"v", "w":"w", "x":"x", "y":"y", "z":"z", "A":"A", "B":"B", "C":"C", "D":"D", "E":"E", "F":"F", "ta":"", "tb":"bb", "tc":"ccc", "td":"dddd", "te":"e", "tf":"", "tg":"ggg", "th":"HHHHHHHHHHHHHHHHHHHH", "ti":"i", "tj":"jj", "tk":"", "tl":"llll", "tm":"m", "tn":"nn", "to":"OOOOOOOOOOOOOOOOOOOO", "tp":"", "tq":"q", "tr":"rr", "ts":"sss", "tt":"tttt", "tu":"", "tv":"VVVVVVVVVVVVVVVVVVVV", "tw":"www", "tx":"xxxx", "ty":"y", "tz":"", "tA":"AAA", "tB":"BBBB", "tC":"CCCCCCCCCCCCCCCCCCCC", "tD":"DD", "tE":"", "tF":"FFFF"}},
+                           "todo":
+            [
+                {
+                    "replace": { "a": "ta", "b": "tb", "c": "tc", "d": "td", "e": "te", "f": "tf", "g": "tg", "h": "th", "i": "ti", "j": "tj", "k": "tk", "l": "tl", "m": "tm", "n": "tn", "o": "to", "p": "tp", "q": "tq", "r": "tr", "s": "ts", "t": "tt", "u": "tu", "v": "tv", "w": "tw", "x": "tx", "y": "ty", "z": "tz", "A": "tA", "B": "tB", "C": "tC", "D": "tD", "E": "tE", "F": "tF" }
+                }
+            ]}
+        )",
+        R"(the quick brown fox jumps over the lazy dog 0123 ABCDEFG xyz!)",
+        R"(ttttHHHHHHHHHHHHHHHHHHHHe qiccc bbrrOOOOOOOOOOOOOOOOOOOOwwwnn OOOOOOOOOOOOOOOOOOOOxxxx jjmsss OOOOOOOOOOOOOOOOOOOOVVVVVVVVVVVVVVVVVVVVerr ttttHHHHHHHHHHHHHHHHHHHHe lllly ddddOOOOOOOOOOOOOOOOOOOOggg 0123 AAABBBBCCCCCCCCCCCCCCCCCCCCDDFFFFG xxxxy!)"
+        },
+        {
+        R"(
+            {"dictionary":{"text":{"ab":"ab", "b":"b", "X":"X", "c":"c", "z":"z", "Z":"Z", "q":"q", "empty":"", "rs":"rs", "t":"t", "!":"!", "e":"e", "f":"f"}},
+                           "todo":
+            [
+                {
+                    "replace": { "ab": "ab", "b": "X" }
+                }
+                , {
+                    "replace": { "c": "c" }
+                }
+                , {
+                    "replace": { "z": "Z" }
+                }
+                , {
+                    "replace": { "q": "empty" }
+                }
+                , {
+                    "replace": { "rs": "t", "z": "!" }
+                }
+                , {
+                    "replace": { "e": "f" }
+                }
+            ]}
+        )",
+        R"(abbcrqszeabqrsbbz)",
+        R"(abXctZfabtXXZ)"
+        }
+    };
+
+    using namespace bpatch;
+    for (auto& tst : arrTests)
+    {
+        // replaces one by one, and composed into transducers
+        for (const size_t maxFusedStates : {size_t(0), ActionsCollection::suggestedMaxFusedStates})
+        {
+            std::vector<char> vec(std::begin(tst.jsonData), std::end(tst.jsonData));
+            ActionsCollection ac(move(vec), maxFusedStates); // processor
+
+            for (size_t blockSize = 1; blockSize <= tst.testData.size(); ++blockSize)
+            {
+                TestWriter tw; // here we accumulating data
+                ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&tw)); // set write point
+
+                for (size_t pos = 0; pos < tst.testData.size(); pos += blockSize)
+                {
+                    ac.DoReplacements(std::span<const char>(tst.testData.substr(pos, blockSize)), false);
+                }
+                ac.DoReplacements(std::span<const char>(), true);
+
+                EXPECT_TRUE(std::ranges::equal(tw.data_accumulator, tst.resultData))
+                    << "block size " << blockSize << ", fused states " << maxFusedStates;
+            }
+        }
+    }
+}
+
+
+TEST(ACollection, PartialMatchesOfSingleLexeme)
+{
+    TestData arrTests[] = {
+        {
+        R"({"dictionary":{"text":{"a4b":"aaaab", "X":"X"}}, "todo":[{"replace": { "a4b": "X" }}]})",
+        R"(aaaaaaabaaaabaaaaaaaaaaab_aaaa)",
+        R"(aaaXXaaaaaaaX_aaaa)"
+        },
+        {
+        R"({"dictionary":{"text":{"abcabd":"abcabd", "X":"X"}}, "todo":[{"replace": { "abcabd": "X" }}]})",
+        R"(abcabcabdabcababcabdabcab)",
+        R"(abcXabcabXabcab)"
+        },
+        {
+        R"({"dictionary":{"text":{"abab":"abab", "X":"X"}}, "todo":[{"replace": { "abab": "X" }}]})",
+        R"(abababababaabab)",
+        R"(XXabaX)"
+        },
+        {
+        R"({"dictionary":{"text":{"needle":"needle", "N":"N"}}, "todo":[{"replace": { "needle": "N" }}]})",
+        R"(nee_le needle;needlneedle__neeeeeeedle.needleneedle_nXedle needl_needle needlenee_le needle;needlneedle__neeeeeeedle.needleneedle_nXedle needl_needle needle)",
+        R"(nee_le N;needlN__neeeeeeedle.NN_nXedle needl_N Nnee_le N;needlN__neeeeeeedle.NN_nXedle needl_N N)"
+        },
+        {
+        R"({"dictionary":{"text":{"long":"0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijX", "L":"L"}}, "todo":[{"replace": { "long": "L" }}]})",
+        R"(__0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijX.0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijY0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijX0123456789abcdefghij01234567890123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijX0123456789abcdefghij0123456789abcdefghij0123456789)",
+        R"(__0123456789abcdefghij0123456789abcdefghijL.0123456789abcdefghij0123456789abcdefghij0123456789abcdefghij0123456789abcdefghijYL0123456789abcdefghij0123456789L0123456789abcdefghij0123456789abcdefghij0123456789)"
+        }
+    };
+
+    for (auto& tst : arrTests)
+    {
+        std::vector<char> vec(std::begin(tst.jsonData), std::end(tst.jsonData));
+
+        using namespace bpatch;
+        ActionsCollection ac(move(vec)); // processor
+
+        for (size_t blockSize = 1; blockSize <= tst.testData.size(); ++blockSize)
+        {
+            TestWriter tw; // here we accumulating data
+            ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&tw)); // set write point
+
+            for (size_t pos = 0; pos < tst.testData.size(); pos += blockSize)
+            {
+                ac.DoReplacements(std::span<const char>(tst.testData.substr(pos, blockSize)), false);
+            }
+            ac.DoReplacements(std::span<const char>(), true);
+
+            EXPECT_TRUE(std::ranges::equal(tw.data_accumulator, tst.resultData)) << "block size " << blockSize;
+        }
+    }
+}
+
+
+/// <summary>
+///   partial matches of long source lexemes are broken after the precomputed part of the failure function
+/// </summary>
+TEST(ACollection, LongPartialMatchesOfSingleLexeme)
+{
+    using namespace std;
+
+    // replaces from the beginning to the end as the stream does
+    auto replaceAll = [](const string& data, const string& src, const string& trg) -> string
+    {
+        string result;
+        size_t pos = 0;
+        for (size_t found; (found = data.find(src, pos)) != string::npos; pos = found + src.size())
+        {
+            result += data.substr(pos, found - pos) + trg;
+        }
+        return result + data.substr(pos);
+    };
+
+    const string aaa(5000, 'a');
+    string abab;
+    for (size_t i = 0; i < 3000; ++i)
+    {
+        abab += "ab";
+    }
+
+    const struct
+    {
+        string src;
+        string data;
+    } tests[] = {
+        {aaa + "b", string(12000, 'a') + "b" + aaa + "c" + aaa.substr(1) + "b" + aaa + "ab"},
+        {abab + "#" + abab + "$", abab + "#" + abab + "#" + abab + "$" + abab + "#" + abab + "#" + abab + "#"},
+    };
+
+    for (auto& tst : tests)
+    {
+        const string json = R"({"dictionary":{"text":{"src":")" + tst.src +
+            R"(", "X":"X"}}, "todo":[{"replace": { "src": "X" }}]})";
+        vector<char> vec(json.begin(), json.end());
+
+        using namespace bpatch;
+        ActionsCollection ac(move(vec)); // processor
+
+        const string expected = replaceAll(tst.data, tst.src, "X");
+        for (const size_t blockSize : {size_t(1), size_t(7), size_t(4096), tst.data.size()})
+        {
+            TestWriter tw; // here we accumulating data
+            ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&tw)); // set write point
+
+            for (size_t pos = 0; pos < tst.data.size(); pos += blockSize)
+            {
+                ac.DoReplacements(span<const char>(tst.data.data() + pos, min(blockSize, tst.data.size() - pos)), false);
+            }
+            ac.DoReplacements(span<const char>(), true);
+
+            EXPECT_TRUE(ranges::equal(tw.data_accumulator, expected)) << "block size " << blockSize;
+        }
+    }
+}
+
+
+/// <summary>
+///   the choice among a long source lexeme and short ones does not build a state per byte of the long lexeme
+/// </summary>
+TEST(ACollection, LongLexemeAmongShortOnes)
+{
+    using namespace std;
+
+    string letters; // 1.1 MB is more than the automaton is built for
+    for (uint32_t i = 0, x = 1; i < 1100000; ++i)
+    {
+        x = x * 1103515245 + 12345;
+        letters += static_cast<char>('a' + (x >> 16) % 26);
+    }
+    const string longSrc = letters + "!";
+
+    // pairs in the order of priority
+    const vector<pair<string, string>> pairs = {
+        {letters.substr(letters.size() - 1) + "!", "<E>"}, {longSrc, "<L>"}, {letters.substr(0, 4), "<B>"},
+        {letters.substr(500000, 2), "<M>"}, {letters.substr(10, 1), "<C>"}, {"?", ""} };
+
+    // at each position the first source in the order of priority is replaced
+    auto replaceChoice = [&pairs](const string& data) -> string
+    {
+        string result;
+        for (size_t pos = 0; pos < data.size();)
+        {
+            const auto it = ranges::find_if(pairs, [&](const auto& p) { return data.compare(pos, p.first.size(), p.first) == 0; });
+            if (it == pairs.end())
+            {
+                result += data[pos++];
+                continue;
+            }
+            result += it->second;
+            pos += it->first.size();
+        }
+        return result;
+    };
+
+    const string data = "?" + letters.substr(0, 5) + longSrc + letters + "?" + longSrc.substr(3) + "??" + letters.substr(0, 7) +
+        longSrc + longSrc + letters.substr(0, 20000) + "!" + letters.substr(0, 13);
+
+    string json = R"({"dictionary":{"text":{)";
+    string todo;
+    for (size_t i = 0; i < pairs.size(); ++i)
+    {
+        const string n = to_string(i);
+        json += string(i ? "," : "") + R"("s)" + n + R"(":")" + pairs[i].first + R"(", "t)" + n + R"(":")" + pairs[i].second + '"';
+        todo += string(i ? "," : "") + R"("s)" + n + R"(":"t)" + n + '"';
+    }
+    json += R"(}}, "todo":[{"replace": {)" + todo + "}}]}";
+    vector<char> vec(json.begin(), json.end());
+
+    using namespace bpatch;
+    ActionsCollection ac(move(vec)); // processor
+
+    const string expected = replaceChoice(data);
+    for (const size_t blockSize : {size_t(1), size_t(7), size_t(4096), data.size()})
+    {
+        TestWriter tw; // here we accumulating data
+        ac.SetNextReplacer(StreamReplacer::ReplacerLastInChain(&tw)); // set write point
+
+        for (size_t pos = 0; pos < data.size(); pos += blockSize)
+        {
+            ac.DoReplacements(span<const char>(data.data() + pos, min(blockSize, data.size() - pos)), false);
+        }
+        ac.DoReplacements(span<const char>(), true);
+
+        EXPECT_TRUE(ranges::equal(tw.data_accumulator, expected)) << "block size " << blockSize;
+    }
+}
+
+
+#ifdef __linux__
+namespace
+{
+    /// <summary>
+    ///   file in the temporary folder; it is removed with the object
+    /// </summary>
+    class TemporaryFile final
+    {
+    public:
+        TemporaryFile(const std::string_view name, const std::span<const char> data)
+            : name_((std::filesystem::temp_directory_path() / name).string())
+        {
+            std::ofstream(name_, std::ios::binary).write(data.data(), data.size());
+        }
+
+        ~TemporaryFile()
+        {
+            std::error_code ec;
+            std::filesystem::remove(name_, ec);
+        }
+
+        const char* Name() const noexcept { return name_.c_str(); }
+
+        std::vector<char> Content() const
+        {
+            std::vector<char> content(std::filesystem::file_size(name_));
+            std::ifstream(name_, std::ios::binary).read(content.data(), content.size());
+            return content;
+        }
+
+    private:
+        std::string name_;
+    };
+
+    /// <summary>
+    ///   data without repetitions at distances of powers of 2
+    /// </summary>
+    std::vector<char> PatternData(const size_t size)
+    {
+        std::vector<char> data(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<char>(i * 7 % 251);
+        }
+        return data;
+    }
+};
+
+
+/// <summary>
+///   the file is processed in place: output growing or shrinking is written over the readed data only
+/// </summary>
+TEST(FdProcessing, ReadWriteInPlace)
+{
+    using namespace bpatch;
+    using namespace std;
+
+    for (const bool direct : {false, true})
+    {
+        for (const size_t size : {size_t(1), SZBUFF_FC - 1, SZBUFF_FC, SZBUFF_FC + 1, 3 * SZBUFF_FC + 5})
+        {
+            for (const bool growing : {true, false})
+            {
+                const vector<char> data = PatternData(size);
+                TemporaryFile file("bpatch_inplace_test.bin", data);
+
+                vector<char> expected;
+                {
+                    ReadWriteFdProcessing rw(file.Name(), direct);
+                    vector<char> place(SZBUFF_FC);
+                    size_t position = 0;
+                    do
+                    {
+                        // every byte twice, or every second byte
+                        vector<char> output;
+                        for (const char c : rw.ReadBlock(span(place)))
+                        {
+                            if (growing || position++ % 2 == 0)
+                            {
+                                output.push_back(c);
+                            }
+                            if (growing)
+                            {
+                                output.push_back(c);
+                            }
+                        }
+                        rw.WriteData(span(output), false);
+                        expected.insert(expected.end(), output.begin(), output.end());
+
+                        // data which has not been readed yet is not overwritten
+                        if (!rw.FileReaded())
+                        {
+                            ASSERT_LE(rw.Written(), rw.Readed()) << "size " << size << ", growing " << growing;
+                        }
+                    } while (!rw.FileReaded());
+                    rw.WriteData(span<const char>(), true);
+                    EXPECT_EQ(expected.size(), rw.Written());
+                    EXPECT_EQ(size, rw.Readed());
+                }
+
+                filesystem::resize_file(file.Name(), expected.size());
+                EXPECT_TRUE(ranges::equal(expected, file.Content()))
+                    << "size " << size << ", growing " << growing << ", direct " << direct;
+            }
+        }
+    }
+}
+
+
+/// <summary>
+///   blocks of the mapped file cross pages; pages of processed blocks are released
+///     and give the same data when they are accessed again
+/// </summary>
+TEST(FdProcessing, MappedRead)
+{
+    using namespace bpatch;
+    using namespace std;
+
+    // resident memory of the mapping with the address, from /proc/self/smaps
+    auto residentSize = [](const char* const address) -> size_t
+    {
+        ifstream smaps("/proc/self/smaps");
+        bool inside = false;
+        for (string line; getline(smaps, line);)
+        {
+            if (uintptr_t from = 0, to = 0; sscanf(line.c_str(), "%zx-%zx ", &from, &to) == 2)
+            {
+                inside = from <= reinterpret_cast<uintptr_t>(address) && reinterpret_cast<uintptr_t>(address) < to;
+            }
+            else if (size_t kb = 0; inside && sscanf(line.c_str(), "Rss: %zu kB", &kb) == 1)
+            {
+                return kb * 1024;
+            }
+        }
+        return 0;
+    };
+
+    {
+        TemporaryFile empty("bpatch_mapped_test.bin", span<const char>());
+        EXPECT_EQ(nullptr, MappedReadFdProcessing::MapFile(empty.Name()));
+    }
+    EXPECT_EQ(nullptr, MappedReadFdProcessing::MapFile("/dev/null"));
+
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for (const size_t size : {size_t(1), pageSize - 1, pageSize + 1, SZBUFF_FC + pageSize + 3, 8 * SZBUFF_FC + 5})
+    {
+        for (const size_t blockSize : {SZBUFF_FC, pageSize + 904})
+        {
+            const vector<char> data = PatternData(size);
+            TemporaryFile file("bpatch_mapped_test.bin", data);
+            unique_ptr<Reader> reader = MappedReadFdProcessing::MapFile(file.Name());
+            ASSERT_NE(nullptr, reader);
+
+            vector<char> place(blockSize);
+            const char* first = nullptr; // the first block stays in the mapping
+            size_t readed = 0;
+            do
+            {
+                const span<const char> block = reader->ReadBlock(span(place));
+                ASSERT_TRUE(ranges::equal(block, span(data).subspan(readed, block.size())))
+                    << "size " << size << ", block size " << blockSize << ", position " << readed;
+                first = nullptr == first ? block.data() : first;
+                readed += block.size();
+            } while (!reader->FileReaded());
+            EXPECT_EQ(size, readed);
+            EXPECT_EQ(size, reader->Readed());
+
+            if (size > 4 * SZBUFF_FC)
+            {// few last blocks could stay in memory, but not the whole file
+                EXPECT_LT(residentSize(first), 3 * SZBUFF_FC) << "block size " << blockSize;
+            }
+            EXPECT_TRUE(ranges::equal(span(first, size), data)) << "size " << size << ", block size " << blockSize;
+        }
+    }
+}
+
+
+/// <summary>
+///   files are read and written through io_uring the same; data written by the ring
+///     and data copied by the kernel follow each other
+/// </summary>
+TEST(FdProcessing, UringWriteAndRead)
+{
+    using namespace bpatch;
+    using namespace std;
+#ifndef BPATCH_IO_URING
+    GTEST_SKIP() << "io_uring is not compiled";
+#else
+    if (nullptr == IoRing::Create(1, SZBUFF_FC))
+    {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+
+    for (const size_t size : {size_t(1), SZBUFF_FC - 1, SZBUFF_FC, SZBUFF_FC + 1, 5 * SZBUFF_FC + 3})
+    {
+        const vector<char> data = PatternData(size);
+        TemporaryFile source("bpatch_uring_source.bin", data);
+
+        {
+            unique_ptr<Reader> reader = UringReadFdProcessing::Create(source.Name());
+            ASSERT_NE(nullptr, reader);
+            vector<char> place(SZBUFF_FC);
+            vector<char> readed;
+            do
+            {
+                const span<const char> block = reader->ReadBlock(span(place));
+                readed.insert(readed.end(), block.begin(), block.end());
+            } while (!reader->FileReaded());
+            EXPECT_EQ(size, reader->Readed());
+            EXPECT_TRUE(ranges::equal(data, readed)) << "size " << size;
+        }
+
+        // the first half by portions, the rest is copied after the end of data;
+        //   then few bytes, and the copy of the beginning right after them
+        TemporaryFile target("bpatch_uring_target.bin", span<const char>());
+        const size_t half = size / 2;
+        const size_t tail = min(size, size_t(10));
+        const size_t head = min(size, size_t(3));
+        {
+            unique_ptr<Writer> writer = UringWriteFdProcessing::Create(target.Name());
+            ASSERT_NE(nullptr, writer);
+            for (size_t written = 0; written < half; written += 4097)
+            {
+                writer->WriteData(span(data).subspan(written, min(size_t(4097), half - written)), false);
+            }
+            writer->WriteData(span<const char>(), true);
+
+            const int fd = open(source.Name(), O_RDONLY | O_CLOEXEC);
+            ASSERT_GE(fd, 0);
+            const size_t copied = writer->CopyFrom(fd, half, size - half);
+            writer->WriteData(span(data).subspan(half + copied), false); // the kernel could refuse to copy
+
+            writer->WriteData(span(data).first(tail), false);
+            const size_t copiedHead = writer->CopyFrom(fd, 0, head);
+            close(fd);
+            writer->WriteData(span(data).subspan(copiedHead, head - copiedHead), true);
+            EXPECT_EQ(size + tail + head, writer->Written()) << "size " << size;
+        }
+
+        vector<char> expected = data;
+        expected.insert(expected.end(), data.begin(), data.begin() + tail);
+        expected.insert(expected.end(), data.begin(), data.begin() + head);
+        EXPECT_TRUE(ranges::equal(expected, target.Content())) << "size " << size;
+    }
+#endif // BPATCH_IO_URING
+}
+
+
+/// <summary>
+///   data written bypassing the page cache are readed back the same;
+///     the unaligned tail is padded by writing and cut by resizing of the file
+/// </summary>
+TEST(FdProcessing, DirectWriteAndRead)
+{
+    using namespace bpatch;
+    using namespace std;
+
+    // page cache is used and processed pages are dropped, as if O_DIRECT is not supported
+    struct CacheDroppingFd: public FdProcessing
+    {
+        CacheDroppingFd(const char* fname, const int flags): FdProcessing(fname, flags) {dropCache_ = true;}
+        using FdProcessing::ReadAt;
+        using FdProcessing::WriteAt;
+    };
+
+    const string fname = (filesystem::temp_directory_path() / "bpatch_direct_test.bin").string();
+    vector<char> data(SZBUFF_FC + 7);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<char>(i * 7 % 251);
+    }
+
+    {
+        unique_ptr<Writer> writer = DirectWriteFdProcessing::Create(fname.c_str());
+        ASSERT_NE(nullptr, writer);
+        writer->WriteData(span(data.data(), 5), false);
+        writer->WriteData(span(data.data() + 5, data.size() - 5), false);
+        writer->WriteData(span<const char>(), true);
+        EXPECT_EQ(data.size(), writer->Written());
+    }
+    EXPECT_EQ(data.size(), filesystem::file_size(fname));
+
+    {
+        unique_ptr<Reader> reader = DirectReadFdProcessing::Create(fname.c_str());
+        ASSERT_NE(nullptr, reader);
+        vector<char> place(SZBUFF_FC);
+        vector<char> readed;
+        do
+        {
+            const span<char> block = reader->ReadData(span(place));
+            readed.insert(readed.end(), block.begin(), block.end());
+        } while (!reader->FileReaded());
+        EXPECT_EQ(data.size(), reader->Readed());
+        EXPECT_TRUE(ranges::equal(data, readed));
+    }
+
+    {
+        CacheDroppingFd fd(fname.c_str(), O_RDWR | O_TRUNC);
+        fd.WriteAt(string_view(data.data(), data.size()), 0);
+        vector<char> readed(data.size() + 1);
+        EXPECT_EQ(data.size(), fd.ReadAt(span(readed), 0));
+        readed.pop_back();
+        EXPECT_TRUE(ranges::equal(data, readed));
+    }
+    filesystem::remove(fname);
+
+    // pipes and special files are not processed bypassing the page cache
+    EXPECT_EQ(nullptr, DirectReadFdProcessing::Create("/dev/null"));
+    EXPECT_EQ(nullptr, DirectWriteFdProcessing::Create("/dev/null"));
+}
+#endif // __linux__
+
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest(&argc, argv);